@@ -0,0 +1,170 @@
+#include <cstring>
+#include <algorithm>
+
+#include "BenchmarkSong.h"
+#include "AgbTypes.h"
+#include "Rom.h"
+
+using namespace std;
+using namespace agbplay;
+
+#define BENCH_SONG_TRACKS 16
+// 150 BPM are 60 ticks per second, so the loop lasts a minute
+#define BENCH_SONG_TEMPO 75
+#define BENCH_SONG_LOOP_TICKS 3600
+#define BENCH_SONG_INSTRUMENTS 128
+
+/*
+ * public BenchmarkSong
+ */
+
+BenchmarkSong::BenchmarkSong(uint32_t seed) : rng(seed)
+{
+    vector<uint8_t>& rom = fc.data;
+    Rom::WriteHeader(rom, "BNCH");
+
+    // only integer math, so the samples are the same everywhere
+    vector<int8_t> tone(2048);
+    for (size_t i = 0; i < tone.size(); i++) {
+        int saw = int(i % 32) * 4 - 64;
+        int tri = int(i % 64) < 32 ? int(i % 64) * 2 - 32 : 96 - int(i % 64) * 2;
+        tone[i] = int8_t(saw / 2 + tri + int(random(17)) - 8);
+    }
+    vector<int8_t> pluck(3072);
+    for (size_t i = 0; i < pluck.size(); i++) {
+        int env = 120 - int(i * 120 / pluck.size());
+        pluck[i] = int8_t((i % 20) < 10 ? env : -env);
+    }
+    vector<int8_t> drum(1536);
+    for (size_t i = 0; i < drum.size(); i++) {
+        int env = 120 - int(i * 120 / drum.size());
+        drum[i] = int8_t(int(random(uint32_t(2 * env + 1))) - env);
+    }
+    long tonePos = addSample(tone, true, 1024, 8000);
+    long pluckPos = addSample(pluck, false, 0, 13379);
+    long drumPos = addSample(drum, false, 0, 10512);
+    align();
+    long wavePos = long(rom.size());
+    for (uint8_t i = 0; i < 16; i++)
+        rom.push_back(uint8_t(i < 8 ? i * 0x22 + 0x01 : (15 - i) * 0x22 + 0x10));
+
+    align();
+    long bankPos = long(rom.size());
+    addInstrument(0x00, 0, uint32_t(tonePos + AGB_MAP_ROM), 0xFF, 0xF0, 0xC0, 0xD0);
+    addInstrument(0x00, 0, uint32_t(pluckPos + AGB_MAP_ROM), 0x80, 0xFA, 0x80, 0xE0);
+    addInstrument(0x08, 0xC0 + 20, uint32_t(drumPos + AGB_MAP_ROM), 0xFF, 0x00, 0xFF, 0x00);
+    addInstrument(0x01, 0, 2, 0, 2, 10, 3);
+    addInstrument(0x02, 0, 1, 0, 2, 9, 2);
+    addInstrument(0x03, 0, uint32_t(wavePos + AGB_MAP_ROM), 0, 1, 12, 2);
+    addInstrument(0x04, 0, 0, 0, 1, 8, 1);
+    for (size_t i = 7; i < BENCH_SONG_INSTRUMENTS; i++)
+        addInstrument(0x01, 0, 2, 0, 2, 10, 3);
+
+    // mostly PCM tracks, one track per CGB channel
+    const uint8_t voices[BENCH_SONG_TRACKS] = { 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 0, 3, 4, 5, 6 };
+    long trackPos[BENCH_SONG_TRACKS];
+    for (size_t i = 0; i < BENCH_SONG_TRACKS; i++)
+        trackPos[i] = addTrack(voices[i], 40, 90, uint8_t(i % 4 == 0 ? 20 : 0));
+
+    align();
+    songPos = long(rom.size());
+    rom.push_back(BENCH_SONG_TRACKS);
+    rom.push_back(0);
+    rom.push_back(0);
+    // engine reverb
+    rom.push_back(0xC0);
+    uint32_t ptrs[BENCH_SONG_TRACKS + 1];
+    ptrs[0] = uint32_t(bankPos + AGB_MAP_ROM);
+    for (size_t i = 0; i < BENCH_SONG_TRACKS; i++)
+        ptrs[i + 1] = uint32_t(trackPos[i] + AGB_MAP_ROM);
+    rom.insert(rom.end(), (uint8_t *)ptrs, (uint8_t *)ptrs + sizeof(ptrs));
+}
+
+BenchmarkSong::~BenchmarkSong()
+{
+}
+
+FileContainer& BenchmarkSong::GetContainer()
+{
+    return fc;
+}
+
+long BenchmarkSong::GetSongPos()
+{
+    return songPos;
+}
+
+/*
+ * private BenchmarkSong
+ */
+
+long BenchmarkSong::addSample(const vector<int8_t>& data, bool loop, uint32_t loopPos, uint32_t freq)
+{
+    align();
+    long pos = long(fc.data.size());
+    uint32_t header[4] = { loop ? 0x40000000u : 0u, freq * 1024, loopPos, uint32_t(data.size()) };
+    fc.data.insert(fc.data.end(), (uint8_t *)header, (uint8_t *)header + sizeof(header));
+    fc.data.insert(fc.data.end(), (const uint8_t *)data.data(), (const uint8_t *)data.data() + data.size());
+    return pos;
+}
+
+void BenchmarkSong::addInstrument(uint8_t type, uint8_t pan, uint32_t field4, uint8_t att, uint8_t dec, uint8_t sus, uint8_t rel)
+{
+    uint8_t instr[12] = { type, 60, 0, pan, 0, 0, 0, 0, att, dec, sus, rel };
+    memcpy(&instr[4], &field4, sizeof(field4));
+    fc.data.insert(fc.data.end(), instr, instr + sizeof(instr));
+}
+
+long BenchmarkSong::addTrack(uint8_t voice, uint8_t lowKey, uint8_t highKey, uint8_t mod)
+{
+    // note lengths of 6 to 72 ticks and delays of 6 to 24 ticks
+    const uint8_t notes[] = { 0xD5, 0xDB, 0xE3, 0xE7, 0xEB, 0xEF, 0xF7 };
+    const uint8_t waits[] = { 6, 12, 16, 24 };
+
+    vector<uint8_t>& rom = fc.data;
+    align();
+    long start = long(rom.size());
+    // TEMPO, VOICE, VOL, PAN, LFOS, MOD
+    uint8_t init[] = { 0xBB, BENCH_SONG_TEMPO, 0xBD, voice, 0xBE, 80, 0xBF, 0x40, 0xC2, 20, 0xC4, mod };
+    rom.insert(rom.end(), init, init + sizeof(init));
+    // the loop starts on a tick, so loop exports of the song are seamless
+    rom.push_back(0x81);
+    long loopPos = long(rom.size());
+    uint32_t ticks = 0;
+    while (ticks < BENCH_SONG_LOOP_TICKS) {
+        if (random(100) < 95) {
+            rom.push_back(notes[random(sizeof(notes))]);
+            rom.push_back(uint8_t(lowKey + random(uint32_t(highKey - lowKey))));
+            rom.push_back(uint8_t(40 + random(88)));
+        }
+        if (random(10) == 0) {
+            rom.push_back(0xBF);
+            rom.push_back(uint8_t(0x10 + random(0x60)));
+        }
+        if (random(20) == 0) {
+            rom.push_back(0xBE);
+            rom.push_back(uint8_t(0x30 + random(0x20)));
+        }
+        uint32_t wait = min<uint32_t>(waits[random(sizeof(waits))], BENCH_SONG_LOOP_TICKS - ticks);
+        rom.push_back(uint8_t(0x80 + wait));
+        ticks += wait;
+    }
+    // GOTO loop, FINE
+    uint32_t loopPtr = uint32_t(loopPos + AGB_MAP_ROM);
+    rom.push_back(0xB2);
+    rom.insert(rom.end(), (uint8_t *)&loopPtr, (uint8_t *)&loopPtr + sizeof(loopPtr));
+    rom.push_back(0xB1);
+    return start;
+}
+
+void BenchmarkSong::align()
+{
+    while (fc.data.size() % 4)
+        fc.data.push_back(0);
+}
+
+uint32_t BenchmarkSong::random(uint32_t range)
+{
+    // mt19937 is the same everywhere, the standard distributions aren't
+    return uint32_t(rng() % range);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <random>
+
+#include "FileContainer.h"
+
+namespace agbplay
+{
+    /*
+     * BenchmarkSong builds a ROM with a single synthetic song. Its 16 tracks start
+     * a note on almost every tick and change pan, volume and modulation, mostly on
+     * PCM instruments and on each CGB channel, so it loads the sequencer and the
+     * mixer like the densest game songs. The song only depends on the seed, which
+     * makes timings reproducible without a game ROM.
+     */
+    class BenchmarkSong
+    {
+        public:
+            BenchmarkSong(uint32_t seed);
+            ~BenchmarkSong();
+
+            // the container has to outlive every Rom reader of it
+            FileContainer& GetContainer();
+            long GetSongPos();
+        private:
+            long addSample(const std::vector<int8_t>& data, bool loop, uint32_t loopPos, uint32_t freq);
+            void addInstrument(uint8_t type, uint8_t pan, uint32_t field4, uint8_t att, uint8_t dec, uint8_t sus, uint8_t rel);
+            long addTrack(uint8_t voice, uint8_t lowKey, uint8_t highKey, uint8_t mod);
+            void align();
+            uint32_t random(uint32_t range);
+
+            FileContainer fc;
+            std::mt19937 rng;
+            long songPos;
+    };
+}
@@ -7,6 +7,7 @@
 #include "Debug.h"
 #include "Util.h"
 #include "Constants.h"
+#include "MixKernels.h"
 
 using namespace std;
 using namespace agbplay;
@@ -29,6 +30,15 @@ CGBChannel::CGBChannel()
     this->eState = EnvState::DEAD;
 }
 
+CGBChannel::CGBChannel(const CGBChannel& other)
+    : pos(other.pos), freq(other.freq), env(other.env), note(other.note), def(other.def),
+    eState(other.eState), nextState(other.nextState), pan(other.pan),
+    rs(other.rs ? other.rs->Clone() : nullptr), envInterStep(other.envInterStep),
+    envLevel(other.envLevel), envPeak(other.envPeak), envSustain(other.envSustain),
+    fromPan(other.fromPan), fromEnvLevel(other.fromEnvLevel), owner(other.owner)
+{
+}
+
 CGBChannel::~CGBChannel()
 {
 }
@@ -352,29 +362,33 @@ void SquareChannel::Process(float *buffer, size_t nblocks, MixingArgs& args)
 
     rs->Process(outBuffer, nblocks, interStep, sampleFetchCallback, this);
 
-    size_t i = 0;
-    do {
-        float samp = outBuffer[i++];
-        *buffer++ += samp * lVol;
-        *buffer++ += samp * rVol;
-        lVol += lVolStep;
-        rVol += rVolStep;
-    } while (--nblocks > 0);
+    MixKernels::MixMonoRamp(buffer, outBuffer, nblocks, lVol, rVol, lVolStep, rVolStep);
 
     updateVolFade();
 }
 
-bool SquareChannel::sampleFetchCallback(std::vector<float>& fetchBuffer, size_t samplesRequired, void *cbdata)
+void SquareChannel::Skip(size_t nblocks, MixingArgs& args)
 {
-    if (fetchBuffer.size() >= samplesRequired)
+    stepEnvelope();
+    if (eState == EnvState::DEAD)
+        return;
+    if (nblocks == 0)
+        return;
+
+    rs->Skip(nblocks, freq * args.sampleRateReciprocal, sampleFetchCallback, this);
+    updateVolFade();
+}
+
+bool SquareChannel::sampleFetchCallback(FetchBuffer& fetchBuffer, size_t samplesRequired, void *cbdata)
+{
+    if (fetchBuffer.Size() >= samplesRequired)
         return true;
     SquareChannel *_this = static_cast<SquareChannel *>(cbdata);
-    size_t samplesToFetch = samplesRequired - fetchBuffer.size();
-    size_t i = fetchBuffer.size();
-    fetchBuffer.resize(samplesRequired);
+    size_t samplesToFetch = samplesRequired - fetchBuffer.Size();
+    float *dest = fetchBuffer.Append(samplesToFetch);
 
     do {
-        fetchBuffer[i++] = _this->pat[_this->pos++];
+        *dest++ = _this->pat[_this->pos++];
         _this->pos %= 8;
     } while (--samplesToFetch > 0);
     return true;
@@ -450,29 +464,33 @@ void WaveChannel::Process(float *buffer, size_t nblocks, MixingArgs& args)
 
     rs->Process(outBuffer, nblocks, interStep, sampleFetchCallback, this);
 
-    size_t i = 0;
-    do {
-        float samp = outBuffer[i++];
-        *buffer++ += samp * lVol;
-        *buffer++ += samp * rVol;
-        lVol += lVolStep;
-        rVol += rVolStep;
-    } while (--nblocks > 0);
+    MixKernels::MixMonoRamp(buffer, outBuffer, nblocks, lVol, rVol, lVolStep, rVolStep);
 
     updateVolFade();
 }
 
-bool WaveChannel::sampleFetchCallback(std::vector<float>& fetchBuffer, size_t samplesRequired, void *cbdata)
+void WaveChannel::Skip(size_t nblocks, MixingArgs& args)
 {
-    if (fetchBuffer.size() >= samplesRequired)
+    stepEnvelope();
+    if (eState == EnvState::DEAD)
+        return;
+    if (nblocks == 0)
+        return;
+
+    rs->Skip(nblocks, freq * args.sampleRateReciprocal, sampleFetchCallback, this);
+    updateVolFade();
+}
+
+bool WaveChannel::sampleFetchCallback(FetchBuffer& fetchBuffer, size_t samplesRequired, void *cbdata)
+{
+    if (fetchBuffer.Size() >= samplesRequired)
         return true;
     WaveChannel *_this = static_cast<WaveChannel *>(cbdata);
-    size_t samplesToFetch = samplesRequired - fetchBuffer.size();
-    size_t i = fetchBuffer.size();
-    fetchBuffer.resize(samplesRequired);
+    size_t samplesToFetch = samplesRequired - fetchBuffer.Size();
+    float *dest = fetchBuffer.Append(samplesToFetch);
 
     do {
-        fetchBuffer[i++] = _this->waveBuffer[_this->pos++];
+        *dest++ = _this->waveBuffer[_this->pos++];
         _this->pos %= 32;
     } while (--samplesToFetch > 0);
     return true;
@@ -550,38 +568,49 @@ void NoiseChannel::Process(float *buffer, size_t nblocks, MixingArgs& args)
     rcd.cbdata = this;
 
     srs.Process(outBuffer, nblocks,
-            NOISE_SAMPLING_FREQ / float(STREAM_SAMPLERATE),
+            NOISE_SAMPLING_FREQ / float(args.sampleRate),
             Resampler::ResamplerChainSampleFetchCB, &rcd);
 
-    size_t i = 0;
-    do {
-        float samp = outBuffer[i++];
-        *buffer++ += samp * lVol;
-        *buffer++ += samp * rVol;
-        lVol += lVolStep;
-        rVol += rVolStep;
-    } while (--nblocks > 0);
+    MixKernels::MixMonoRamp(buffer, outBuffer, nblocks, lVol, rVol, lVolStep, rVolStep);
+
+    updateVolFade();
+}
+
+void NoiseChannel::Skip(size_t nblocks, MixingArgs& args)
+{
+    stepEnvelope();
+    if (eState == EnvState::DEAD)
+        return;
+
+    Resampler::ResamplerChainData rcd;
+    rcd._this = rs.get();
+    rcd.phaseInc = freq / NOISE_SAMPLING_FREQ;
+    rcd.cbPtr = sampleFetchCallback;
+    rcd.cbdata = this;
+
+    srs.Skip(nblocks,
+            NOISE_SAMPLING_FREQ / float(args.sampleRate),
+            Resampler::ResamplerChainSampleFetchCB, &rcd);
 
     updateVolFade();
 }
 
-bool NoiseChannel::sampleFetchCallback(std::vector<float>& fetchBuffer, size_t samplesRequired, void *cbdata)
+bool NoiseChannel::sampleFetchCallback(FetchBuffer& fetchBuffer, size_t samplesRequired, void *cbdata)
 {
-    if (fetchBuffer.size() >= samplesRequired)
+    if (fetchBuffer.Size() >= samplesRequired)
         return true;
     NoiseChannel *_this = static_cast<NoiseChannel *>(cbdata);
-    size_t samplesToFetch = samplesRequired - fetchBuffer.size();
-    size_t i = fetchBuffer.size();
-    fetchBuffer.resize(samplesRequired);
+    size_t samplesToFetch = samplesRequired - fetchBuffer.Size();
+    float *dest = fetchBuffer.Append(samplesToFetch);
 
     if (_this->def.np == NoisePatt::FINE) {
         do {
-            fetchBuffer[i++] = CGBPatterns::pat_noise_fine[_this->pos++] - 0.5f;
+            *dest++ = CGBPatterns::pat_noise_fine[_this->pos++] - 0.5f;
             _this->pos %= NOISE_FINE_LEN;
         } while (--samplesToFetch > 0);
     } else if (_this->def.np == NoisePatt::ROUGH) {
         do {
-            fetchBuffer[i++] = CGBPatterns::pat_noise_rough[_this->pos++] - 0.5f;
+            *dest++ = CGBPatterns::pat_noise_rough[_this->pos++] - 0.5f;
             _this->pos %= NOISE_ROUGH_LEN;
         } while (--samplesToFetch > 0);
     }
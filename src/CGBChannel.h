@@ -17,9 +17,12 @@ namespace agbplay
     {
         public: 
             CGBChannel();
+            CGBChannel(const CGBChannel& other);
             ~CGBChannel();
             virtual void Init(uint8_t owner, CGBDef def, Note note, ADSR env);
             virtual void Process(float *buffer, size_t nblocks, MixingArgs& args) = 0;
+            // advances the channel like Process does, but without mixing any audio
+            virtual void Skip(size_t nblocks, MixingArgs& args) = 0;
             uint8_t GetOwner();
             void SetVol(uint8_t vol, int8_t pan);
             uint8_t GetMidiKey();
@@ -61,10 +64,11 @@ namespace agbplay
             void Init(uint8_t owner, CGBDef def, Note note, ADSR env) override;
             void SetPitch(int16_t pitch) override;
             void Process(float *buffer, size_t nblocks, MixingArgs& args) override;
+            void Skip(size_t nblocks, MixingArgs& args) override;
 
             const float *pat;
         private:
-            static bool sampleFetchCallback(std::vector<float>& fetchBuffer, size_t samplesRequired, void *cbdata);
+            static bool sampleFetchCallback(FetchBuffer& fetchBuffer, size_t samplesRequired, void *cbdata);
     };
 
     class WaveChannel : public CGBChannel
@@ -76,8 +80,9 @@ namespace agbplay
             void Init(uint8_t owner, CGBDef def, Note note, ADSR env) override;
             void SetPitch(int16_t pitch) override;
             void Process(float *buffer, size_t nblocks, MixingArgs& args) override;
+            void Skip(size_t nblocks, MixingArgs& args) override;
         private:
-            static bool sampleFetchCallback(std::vector<float>& fetchBuffer, size_t samplesRequired, void *cbdata);
+            static bool sampleFetchCallback(FetchBuffer& fetchBuffer, size_t samplesRequired, void *cbdata);
             float waveBuffer[32];
             static uint8_t volLut[16];
     };
@@ -92,8 +97,9 @@ namespace agbplay
             float NoiseKeyToFreq(int8_t key);
             void SetPitch(int16_t pitch) override;
             void Process(float *buffer, size_t nblocks, MixingArgs& args) override;
+            void Skip(size_t nblocks, MixingArgs& args) override;
         private:
-            static bool sampleFetchCallback(std::vector<float>& fetchBuffer, size_t samplesRequired, void *cbdata);
+            static bool sampleFetchCallback(FetchBuffer& fetchBuffer, size_t samplesRequired, void *cbdata);
             SincResampler srs;
     };
 }
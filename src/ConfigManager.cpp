@@ -7,6 +7,7 @@
 #include "ConfigManager.h"
 #include "Util.h"
 #include "Xcept.h"
+#include "Constants.h"
 
 using namespace std;
 using namespace agbplay;
@@ -27,10 +28,14 @@ ConfigManager::ConfigManager(const string& configPath)
     regex cfgRevExpr("^\\s*ENG_REV\\s*=\\s*(\\d+)\\s*$");
     regex cfgRevTypeExpr("^\\s*ENG_REV_TYPE\\s*=\\s*(.*)\\s*$");
     regex cfgTrackLimitExpr("^\\s*TRACK_LIMIT\\s*=\\s*(\\d+)\\s*$");
+    regex cfgPcmVoiceLimitExpr("^\\s*PCM_VOICE_LIMIT\\s*=\\s*(\\d+)\\s*$");
     regex cfgPcmRes("^\\s*PCM_RES_TYPE\\s*=\\s*(.*)\\s*$");
     regex cfgPcmFixedRes("^\\s*PCM_FIX_RES_TYPE\\s*=\\s*(.*)\\s*$");
     regex cfgRevBufSize("^\\s*REV_BUF_SIZE\\s*=\\s*(\\d+)\\s*$");
     regex cfgMono("^\\s*MONO\\s*=\\s*(.*)\\s*$");
+    regex cfgRenderCache("^\\s*RENDER_CACHE\\s*=\\s*(.*?)\\s*$");
+    regex cfgEngineRateMix("^\\s*ENGINE_RATE_MIX\\s*=\\s*(.*)\\s*$");
+    regex cfgSampleRate("^\\s*SAMPLE_RATE\\s*=\\s*(\\d+)\\s*$");
 
     while (getline(configFile, line)) {
         if (configFile.bad()) {
@@ -59,6 +64,9 @@ ConfigManager::ConfigManager(const string& configPath)
         else if (regex_match(line, sm, cfgTrackLimitExpr) && sm.size() == 2 && curCfg) {
             curCfg->SetTrackLimit(uint8_t(clip<int>(0, stoi(sm[1]), 16)));
         }
+        else if (regex_match(line, sm, cfgPcmVoiceLimitExpr) && sm.size() == 2 && curCfg) {
+            curCfg->SetPCMVoiceLimit(uint8_t(clip<int>(0, stoi(sm[1]), 255)));
+        }
         else if (regex_match(line, sm, cfgPcmRes) && sm.size() == 2 && curCfg) {
             curCfg->SetResType(str2res(sm[1]));
         }
@@ -69,7 +77,20 @@ ConfigManager::ConfigManager(const string& configPath)
             curCfg->SetRevBufSize(uint16_t(stoul(sm[1])));
 	    }
         else if (regex_match(line, sm, cfgMono) && sm.size() == 2 && curCfg) {
-            curCfg->SetMono(str2mono(sm[1]));
+            curCfg->SetMono(str2bool(sm[1]));
+        }
+        else if (regex_match(line, sm, cfgRenderCache) && sm.size() == 2 && curCfg) {
+            curCfg->SetRenderCache(sm[1]);
+        }
+        else if (regex_match(line, sm, cfgEngineRateMix) && sm.size() == 2 && curCfg) {
+            curCfg->SetEngineRateMix(str2bool(sm[1]));
+        }
+        else if (regex_match(line, sm, cfgSampleRate) && sm.size() == 2 && curCfg) {
+            // 0 means automatic
+            uint32_t rate = uint32_t(stoul(sm[1]));
+            if (rate != 0)
+                rate = clip<uint32_t>(MIN_SAMPLERATE, rate, MAX_SAMPLERATE);
+            curCfg->SetSampleRate(rate);
         }
     }
 
@@ -93,8 +114,15 @@ ConfigManager::~ConfigManager()
         configFile << "PCM_RES_TYPE = " << res2str(cfg.GetResType()) << endl;
         configFile << "PCM_FIX_RES_TYPE = " << res2str(cfg.GetResTypeFixed()) << endl;
         configFile << "TRACK_LIMIT = " << static_cast<int>(cfg.GetTrackLimit()) << endl;
+        configFile << "PCM_VOICE_LIMIT = " << static_cast<int>(cfg.GetPCMVoiceLimit()) << endl;
         configFile << "REV_BUF_SIZE = " << static_cast<int>(cfg.GetRevBufSize()) << endl;
-        configFile << "MONO = " << mono2str(cfg.GetMono()) << endl;
+        configFile << "MONO = " << bool2str(cfg.GetMono()) << endl;
+        if (!cfg.GetRenderCache().empty())
+            configFile << "RENDER_CACHE = " << cfg.GetRenderCache() << endl;
+        if (cfg.GetEngineRateMix())
+            configFile << "ENGINE_RATE_MIX = " << bool2str(cfg.GetEngineRateMix()) << endl;
+        if (cfg.GetSampleRate() != 0)
+            configFile << "SAMPLE_RATE = " << cfg.GetSampleRate() << endl;
 
 
         for (SongEntry entr : cfg.GetGameEntries()) {
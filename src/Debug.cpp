@@ -27,6 +27,8 @@ bool _close_debug() {
 
 static void (*callback)(const std::string&, void *) = nullptr;
 static void *cb_obj = nullptr;
+// messages may come from the mixer and export threads
+static std::mutex debug_lock;
 
 void _set_debug_callback(void (*cb)(const std::string&, void *), void *obj) {
     callback = cb;
@@ -38,6 +40,7 @@ void _print_debug(const char *str, ...) {
     va_start(args, str);
     char txtbuf[512];
     vsnprintf(txtbuf, sizeof(txtbuf), str, args);
+    std::lock_guard<std::mutex> lock(debug_lock);
     fprintf(debug_file, "%s\n", txtbuf);
     fflush(debug_file);
     va_end(args);
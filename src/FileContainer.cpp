@@ -30,6 +30,10 @@ FileContainer::FileContainer(string path)
     is.close();
 }
 
+FileContainer::FileContainer()
+{
+}
+
 FileContainer::~FileContainer() 
 {
 }
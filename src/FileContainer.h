@@ -9,6 +9,8 @@ namespace agbplay
     {
         public:
             FileContainer(std::string filePath);
+            // empty container for ROM data built in memory
+            FileContainer();
             ~FileContainer();
             std::vector<uint8_t> data;
     };
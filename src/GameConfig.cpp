@@ -18,8 +18,11 @@ GameConfig::GameConfig(const string& gameCode)
     engineFreq = 0x4;
     engineRev = 0x0;
     trackLimit = 16;
+    pcmVoiceLimit = 12;
     revBufSize = 1584;
     mono = false;
+    sampleRate = 0;
+    engineRateMix = false;
 }
 
 GameConfig::~GameConfig()
@@ -101,6 +104,16 @@ void GameConfig::SetTrackLimit(uint8_t trackLimit)
     this->trackLimit = clip<uint8_t>(0, trackLimit, 16);
 }
 
+uint8_t GameConfig::GetPCMVoiceLimit()
+{
+    return pcmVoiceLimit;
+}
+
+void GameConfig::SetPCMVoiceLimit(uint8_t pcmVoiceLimit)
+{
+    this->pcmVoiceLimit = pcmVoiceLimit;
+}
+
 uint16_t GameConfig::GetRevBufSize()
 {
     return revBufSize;
@@ -121,7 +134,37 @@ void GameConfig::SetMono(bool mono)
     this->mono = mono;
 }
 
+uint32_t GameConfig::GetSampleRate()
+{
+    return sampleRate;
+}
+
+void GameConfig::SetSampleRate(uint32_t sampleRate)
+{
+    this->sampleRate = sampleRate;
+}
+
+bool GameConfig::GetEngineRateMix()
+{
+    return engineRateMix;
+}
+
+void GameConfig::SetEngineRateMix(bool engineRateMix)
+{
+    this->engineRateMix = engineRateMix;
+}
+
 vector<SongEntry>& GameConfig::GetGameEntries()
 {
     return gameEntries;
 }
+
+const string& GameConfig::GetRenderCache()
+{
+    return renderCache;
+}
+
+void GameConfig::SetRenderCache(const string& renderCache)
+{
+    this->renderCache = renderCache;
+}
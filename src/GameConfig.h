@@ -29,10 +29,22 @@ namespace agbplay
             void SetEngineRev(uint8_t engineRev);
             uint8_t GetTrackLimit();
             void SetTrackLimit(uint8_t trackLimit);
+            // maximum number of PCM voices playing at once, 0 means unlimited
+            uint8_t GetPCMVoiceLimit();
+            void SetPCMVoiceLimit(uint8_t pcmVoiceLimit);
             uint16_t GetRevBufSize();
             void SetRevBufSize(uint16_t revBufSize);
             bool GetMono();
             void SetMono(bool mono);
+            // output sample rate, 0 lets the player use the rate of the audio device
+            uint32_t GetSampleRate();
+            void SetSampleRate(uint32_t sampleRate);
+            // mix PCM voices at the engine rate like the game does and resample the result once
+            bool GetEngineRateMix();
+            void SetEngineRateMix(bool engineRateMix);
+            // directory of the render cache, empty if disabled
+            const std::string& GetRenderCache();
+            void SetRenderCache(const std::string& renderCache);
 
             std::vector<SongEntry>& GetGameEntries();
 
@@ -46,7 +58,11 @@ namespace agbplay
             uint8_t engineFreq;
             uint8_t engineRev;
             uint8_t trackLimit;
+            uint8_t pcmVoiceLimit;
             uint16_t revBufSize;
             bool mono;
+            uint32_t sampleRate;
+            bool engineRateMix;
+            std::string renderCache;
     };
 }
@@ -4,14 +4,15 @@
 #include "LoudnessCalculator.h"
 #include "Constants.h"
 #include "Util.h"
+#include "MixKernels.h"
 
 using namespace agbplay;
 using namespace std;
 
-LoudnessCalculator::LoudnessCalculator(const float lowpassFreq)
+LoudnessCalculator::LoudnessCalculator(const float lowpassFreq, uint32_t sampleRate)
 {
     float rc = 1.0f / (lowpassFreq * 2.0f * float(M_PI));
-    float dt = 1.0f / float(STREAM_SAMPLERATE);
+    float dt = 1.0f / float(sampleRate);
     lpAlpha = dt / (rc + dt);
 
     Reset();
@@ -19,16 +20,32 @@ LoudnessCalculator::LoudnessCalculator(const float lowpassFreq)
 
 void LoudnessCalculator::CalcLoudness(const float *audio, size_t nBlocks)
 {
-    do {
-        float l = *audio++;
-        float r = *audio++;
-        assert(!isnan(l) && !isnan(r));
-        assert(!isinf(l) && !isinf(r));
-        l *= l;
-        r *= r;
-        avgVolLeftSq = avgVolLeftSq + lpAlpha * (l - avgVolLeftSq);
-        avgVolRightSq = avgVolRightSq + lpAlpha * (r - avgVolRightSq);
-    } while (--nBlocks > 0);
+    BeginBuffer(nBlocks);
+    AddAudio(audio, 0, nBlocks);
+    EndBuffer();
+}
+
+void LoudnessCalculator::BeginBuffer(size_t nBlocks)
+{
+    if (nBlocks != weights.size())
+        updateWeights(nBlocks);
+    avgVolLeftSq *= bufferDecay;
+    avgVolRightSq *= bufferDecay;
+}
+
+void LoudnessCalculator::AddAudio(const float *audio, size_t offset, size_t nBlocks)
+{
+    assert(offset + nBlocks <= weights.size());
+    float l, r;
+    MixKernels::WeightedSquares(audio, weights.data() + offset, nBlocks, l, r);
+    avgVolLeftSq += l;
+    avgVolRightSq += r;
+}
+
+void LoudnessCalculator::EndBuffer()
+{
+    assert(!isnan(avgVolLeftSq) && !isnan(avgVolRightSq));
+    assert(!isinf(avgVolLeftSq) && !isinf(avgVolRightSq));
 
     static const float sqrt_2 = sqrtf(2.0f);
 
@@ -49,3 +66,16 @@ void LoudnessCalculator::Reset()
     volLeft = 0.f;
     volRight = 0.f;
 }
+
+void LoudnessCalculator::updateWeights(size_t nBlocks)
+{
+    // sample i is multiplied by alpha and then decays for the remaining samples
+    weights.resize(nBlocks);
+    float decay = 1.0f - lpAlpha;
+    float w = lpAlpha;
+    for (size_t i = nBlocks; i-- > 0;) {
+        weights[i] = w;
+        w *= decay;
+    }
+    bufferDecay = w / lpAlpha;
+}
@@ -1,19 +1,30 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
+#include <vector>
 
 namespace agbplay
 {
     class LoudnessCalculator
     {
         public:
-            LoudnessCalculator(const float lowpassFreq);
+            LoudnessCalculator(const float lowpassFreq, uint32_t sampleRate);
 
             void CalcLoudness(const float *audio, const size_t nBlocks);
+            // same as CalcLoudness, but the buffer can be passed in parts, offset is the position of audio in the buffer
+            void BeginBuffer(size_t nBlocks);
+            void AddAudio(const float *audio, size_t offset, size_t nBlocks);
+            void EndBuffer();
             void GetLoudness(float& lVol, float& rVol);
             void Reset();
         private:
+            void updateWeights(size_t nBlocks);
+
             float lpAlpha;
+            // the lowpass of a whole buffer is decay^n * old + sum(weights[i] * x[i]^2)
+            std::vector<float> weights;
+            float bufferDecay;
             float avgVolLeftSq;
             float avgVolRightSq;
 
@@ -0,0 +1,552 @@
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include <random>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MIX_KERNELS_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define MIX_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+#include "MixKernels.h"
+#include "Constants.h"
+
+using namespace std;
+using namespace agbplay;
+
+/*
+ * scalar reference
+ */
+
+static void mixMonoRampScalar(float *dst, const float *src, size_t nBlocks,
+        float lVol, float rVol, float lVolStep, float rVolStep)
+{
+    for (size_t i = 0; i < nBlocks; i++) {
+        float samp = src[i];
+        *dst++ += samp * lVol;
+        *dst++ += samp * rVol;
+        lVol += lVolStep;
+        rVol += rVolStep;
+    }
+}
+
+static float gainRampScalar(float *buffer, size_t nBlocks, float gain, float gainStep)
+{
+    for (size_t i = 0; i < nBlocks; i++) {
+        buffer[i * N_CHANNELS] *= gain;
+        buffer[i * N_CHANNELS + 1] *= gain;
+        gain += gainStep;
+    }
+    return gain;
+}
+
+static void accumulateScalar(float *dst, const float *src, size_t nElements)
+{
+    for (size_t i = 0; i < nElements; i++)
+        dst[i] += src[i];
+}
+
+static void weightedSquaresScalar(const float *audio, const float *weights, size_t nBlocks,
+        float& left, float& right)
+{
+    float l = 0.0f;
+    float r = 0.0f;
+    for (size_t i = 0; i < nBlocks; i++) {
+        l += weights[i] * audio[i * N_CHANNELS] * audio[i * N_CHANNELS];
+        r += weights[i] * audio[i * N_CHANNELS + 1] * audio[i * N_CHANNELS + 1];
+    }
+    left = l;
+    right = r;
+}
+
+static float interpolatedFirScalar(const float *src, const float *kernel, const float *next, float frac, size_t nTaps)
+{
+    float sum = 0.0f;
+    for (size_t i = 0; i < nTaps; i++)
+        sum += src[i] * (kernel[i] + frac * (next[i] - kernel[i]));
+    return sum;
+}
+
+static const MixKernels::KernelSet scalarKernels = {
+    "scalar", mixMonoRampScalar, gainRampScalar, accumulateScalar, weightedSquaresScalar, interpolatedFirScalar
+};
+
+/*
+ * The vectorized versions calculate the ramped volume of each block as
+ * start + index * step instead of adding up the steps. Remaining blocks
+ * at the end are handled the same way.
+ */
+
+static void mixMonoRampTail(float *dst, const float *src, size_t start, size_t nBlocks,
+        float lVol, float rVol, float lVolStep, float rVolStep)
+{
+    for (size_t i = start; i < nBlocks; i++) {
+        dst[i * N_CHANNELS] += src[i] * (lVol + float(i) * lVolStep);
+        dst[i * N_CHANNELS + 1] += src[i] * (rVol + float(i) * rVolStep);
+    }
+}
+
+static float gainRampTail(float *buffer, size_t start, size_t nBlocks, float gain, float gainStep)
+{
+    for (size_t i = start; i < nBlocks; i++) {
+        float g = gain + float(i) * gainStep;
+        buffer[i * N_CHANNELS] *= g;
+        buffer[i * N_CHANNELS + 1] *= g;
+    }
+    return gain + float(nBlocks) * gainStep;
+}
+
+#ifdef MIX_KERNELS_X86
+
+/*
+ * SSE2, part of every x86-64 CPU
+ */
+
+static void mixMonoRampSSE2(float *dst, const float *src, size_t nBlocks,
+        float lVol, float rVol, float lVolStep, float rVolStep)
+{
+    const __m128 vol = _mm_setr_ps(lVol, rVol, lVol, rVol);
+    const __m128 step = _mm_setr_ps(lVolStep, rVolStep, lVolStep, rVolStep);
+    __m128 index = _mm_setr_ps(0.0f, 0.0f, 1.0f, 1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+    size_t i = 0;
+    for (; i + 4 <= nBlocks; i += 4) {
+        __m128 samp = _mm_loadu_ps(src + i);
+        // duplicate the mono samples for left and right
+        __m128 lo = _mm_unpacklo_ps(samp, samp);
+        __m128 hi = _mm_unpackhi_ps(samp, samp);
+        __m128 volLo = _mm_add_ps(vol, _mm_mul_ps(index, step));
+        index = _mm_add_ps(index, two);
+        __m128 volHi = _mm_add_ps(vol, _mm_mul_ps(index, step));
+        index = _mm_add_ps(index, two);
+        float *out = dst + i * N_CHANNELS;
+        _mm_storeu_ps(out, _mm_add_ps(_mm_loadu_ps(out), _mm_mul_ps(lo, volLo)));
+        _mm_storeu_ps(out + 4, _mm_add_ps(_mm_loadu_ps(out + 4), _mm_mul_ps(hi, volHi)));
+    }
+    mixMonoRampTail(dst, src, i, nBlocks, lVol, rVol, lVolStep, rVolStep);
+}
+
+static float gainRampSSE2(float *buffer, size_t nBlocks, float gain, float gainStep)
+{
+    const __m128 g = _mm_set1_ps(gain);
+    const __m128 step = _mm_set1_ps(gainStep);
+    __m128 index = _mm_setr_ps(0.0f, 0.0f, 1.0f, 1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+    size_t i = 0;
+    for (; i + 2 <= nBlocks; i += 2) {
+        float *out = buffer + i * N_CHANNELS;
+        __m128 gains = _mm_add_ps(g, _mm_mul_ps(index, step));
+        index = _mm_add_ps(index, two);
+        _mm_storeu_ps(out, _mm_mul_ps(_mm_loadu_ps(out), gains));
+    }
+    return gainRampTail(buffer, i, nBlocks, gain, gainStep);
+}
+
+static void accumulateSSE2(float *dst, const float *src, size_t nElements)
+{
+    size_t i = 0;
+    for (; i + 4 <= nElements; i += 4)
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_loadu_ps(src + i)));
+    accumulateScalar(dst + i, src + i, nElements - i);
+}
+
+static void weightedSquaresSSE2(const float *audio, const float *weights, size_t nBlocks,
+        float& left, float& right)
+{
+    __m128 acc = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 2 <= nBlocks; i += 2) {
+        __m128 w = _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double *>(weights + i)));
+        w = _mm_unpacklo_ps(w, w);
+        __m128 a = _mm_loadu_ps(audio + i * N_CHANNELS);
+        acc = _mm_add_ps(acc, _mm_mul_ps(w, _mm_mul_ps(a, a)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc);
+    float l = lanes[0] + lanes[2];
+    float r = lanes[1] + lanes[3];
+    for (; i < nBlocks; i++) {
+        l += weights[i] * audio[i * N_CHANNELS] * audio[i * N_CHANNELS];
+        r += weights[i] * audio[i * N_CHANNELS + 1] * audio[i * N_CHANNELS + 1];
+    }
+    left = l;
+    right = r;
+}
+
+static float interpolatedFirSSE2(const float *src, const float *kernel, const float *next, float frac, size_t nTaps)
+{
+    const __m128 f = _mm_set1_ps(frac);
+    __m128 acc = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= nTaps; i += 4) {
+        __m128 k = _mm_loadu_ps(kernel + i);
+        k = _mm_add_ps(k, _mm_mul_ps(f, _mm_sub_ps(_mm_loadu_ps(next + i), k)));
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(src + i), k));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc);
+    float sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    return sum + interpolatedFirScalar(src + i, kernel + i, next + i, frac, nTaps - i);
+}
+
+static const MixKernels::KernelSet sse2Kernels = {
+    "sse2", mixMonoRampSSE2, gainRampSSE2, accumulateSSE2, weightedSquaresSSE2, interpolatedFirSSE2
+};
+
+/*
+ * AVX2, only used if the CPU supports it
+ */
+
+__attribute__((target("avx2")))
+static void mixMonoRampAVX2(float *dst, const float *src, size_t nBlocks,
+        float lVol, float rVol, float lVolStep, float rVolStep)
+{
+    const __m256 vol = _mm256_setr_ps(lVol, rVol, lVol, rVol, lVol, rVol, lVol, rVol);
+    const __m256 step = _mm256_setr_ps(lVolStep, rVolStep, lVolStep, rVolStep,
+            lVolStep, rVolStep, lVolStep, rVolStep);
+    __m256 index = _mm256_setr_ps(0.0f, 0.0f, 1.0f, 1.0f, 2.0f, 2.0f, 3.0f, 3.0f);
+    const __m256 four = _mm256_set1_ps(4.0f);
+    size_t i = 0;
+    for (; i + 8 <= nBlocks; i += 8) {
+        __m256 samp = _mm256_loadu_ps(src + i);
+        // unpack works per 128 bit lane, so the halves have to be put back in order
+        __m256 lo = _mm256_unpacklo_ps(samp, samp);
+        __m256 hi = _mm256_unpackhi_ps(samp, samp);
+        __m256 first = _mm256_permute2f128_ps(lo, hi, 0x20);
+        __m256 second = _mm256_permute2f128_ps(lo, hi, 0x31);
+        __m256 volFirst = _mm256_add_ps(vol, _mm256_mul_ps(index, step));
+        index = _mm256_add_ps(index, four);
+        __m256 volSecond = _mm256_add_ps(vol, _mm256_mul_ps(index, step));
+        index = _mm256_add_ps(index, four);
+        float *out = dst + i * N_CHANNELS;
+        _mm256_storeu_ps(out, _mm256_add_ps(_mm256_loadu_ps(out), _mm256_mul_ps(first, volFirst)));
+        _mm256_storeu_ps(out + 8, _mm256_add_ps(_mm256_loadu_ps(out + 8), _mm256_mul_ps(second, volSecond)));
+    }
+    mixMonoRampTail(dst, src, i, nBlocks, lVol, rVol, lVolStep, rVolStep);
+}
+
+__attribute__((target("avx2")))
+static float gainRampAVX2(float *buffer, size_t nBlocks, float gain, float gainStep)
+{
+    const __m256 g = _mm256_set1_ps(gain);
+    const __m256 step = _mm256_set1_ps(gainStep);
+    __m256 index = _mm256_setr_ps(0.0f, 0.0f, 1.0f, 1.0f, 2.0f, 2.0f, 3.0f, 3.0f);
+    const __m256 four = _mm256_set1_ps(4.0f);
+    size_t i = 0;
+    for (; i + 4 <= nBlocks; i += 4) {
+        float *out = buffer + i * N_CHANNELS;
+        __m256 gains = _mm256_add_ps(g, _mm256_mul_ps(index, step));
+        index = _mm256_add_ps(index, four);
+        _mm256_storeu_ps(out, _mm256_mul_ps(_mm256_loadu_ps(out), gains));
+    }
+    return gainRampTail(buffer, i, nBlocks, gain, gainStep);
+}
+
+__attribute__((target("avx2")))
+static void accumulateAVX2(float *dst, const float *src, size_t nElements)
+{
+    size_t i = 0;
+    for (; i + 8 <= nElements; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_loadu_ps(src + i)));
+    accumulateScalar(dst + i, src + i, nElements - i);
+}
+
+__attribute__((target("avx2")))
+static void weightedSquaresAVX2(const float *audio, const float *weights, size_t nBlocks,
+        float& left, float& right)
+{
+    __m256 acc = _mm256_setzero_ps();
+    const __m256i dup = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    size_t i = 0;
+    for (; i + 4 <= nBlocks; i += 4) {
+        __m256 w = _mm256_castps128_ps256(_mm_loadu_ps(weights + i));
+        w = _mm256_permutevar8x32_ps(w, dup);
+        __m256 a = _mm256_loadu_ps(audio + i * N_CHANNELS);
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(w, _mm256_mul_ps(a, a)));
+    }
+    float lanes[8];
+    _mm256_storeu_ps(lanes, acc);
+    float l = (lanes[0] + lanes[2]) + (lanes[4] + lanes[6]);
+    float r = (lanes[1] + lanes[3]) + (lanes[5] + lanes[7]);
+    for (; i < nBlocks; i++) {
+        l += weights[i] * audio[i * N_CHANNELS] * audio[i * N_CHANNELS];
+        r += weights[i] * audio[i * N_CHANNELS + 1] * audio[i * N_CHANNELS + 1];
+    }
+    left = l;
+    right = r;
+}
+
+__attribute__((target("avx2")))
+static float interpolatedFirAVX2(const float *src, const float *kernel, const float *next, float frac, size_t nTaps)
+{
+    const __m256 f = _mm256_set1_ps(frac);
+    __m256 acc = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= nTaps; i += 8) {
+        __m256 k = _mm256_loadu_ps(kernel + i);
+        k = _mm256_add_ps(k, _mm256_mul_ps(f, _mm256_sub_ps(_mm256_loadu_ps(next + i), k)));
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(src + i), k));
+    }
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    float lanes[4];
+    _mm_storeu_ps(lanes, half);
+    float sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    return sum + interpolatedFirScalar(src + i, kernel + i, next + i, frac, nTaps - i);
+}
+
+static const MixKernels::KernelSet avx2Kernels = {
+    "avx2", mixMonoRampAVX2, gainRampAVX2, accumulateAVX2, weightedSquaresAVX2, interpolatedFirAVX2
+};
+
+#endif // MIX_KERNELS_X86
+
+#ifdef MIX_KERNELS_NEON
+
+/*
+ * NEON, part of every ARMv8 CPU, 32 bit ARM builds need it enabled at compile time
+ */
+
+static void mixMonoRampNEON(float *dst, const float *src, size_t nBlocks,
+        float lVol, float rVol, float lVolStep, float rVolStep)
+{
+    const float volInit[4] = { lVol, rVol, lVol, rVol };
+    const float stepInit[4] = { lVolStep, rVolStep, lVolStep, rVolStep };
+    const float indexInit[4] = { 0.0f, 0.0f, 1.0f, 1.0f };
+    const float32x4_t vol = vld1q_f32(volInit);
+    const float32x4_t step = vld1q_f32(stepInit);
+    float32x4_t index = vld1q_f32(indexInit);
+    const float32x4_t two = vdupq_n_f32(2.0f);
+    size_t i = 0;
+    for (; i + 4 <= nBlocks; i += 4) {
+        // duplicate the mono samples for left and right
+        float32x4x2_t samp = vzipq_f32(vld1q_f32(src + i), vld1q_f32(src + i));
+        float32x4_t volLo = vaddq_f32(vol, vmulq_f32(index, step));
+        index = vaddq_f32(index, two);
+        float32x4_t volHi = vaddq_f32(vol, vmulq_f32(index, step));
+        index = vaddq_f32(index, two);
+        float *out = dst + i * N_CHANNELS;
+        vst1q_f32(out, vaddq_f32(vld1q_f32(out), vmulq_f32(samp.val[0], volLo)));
+        vst1q_f32(out + 4, vaddq_f32(vld1q_f32(out + 4), vmulq_f32(samp.val[1], volHi)));
+    }
+    mixMonoRampTail(dst, src, i, nBlocks, lVol, rVol, lVolStep, rVolStep);
+}
+
+static float gainRampNEON(float *buffer, size_t nBlocks, float gain, float gainStep)
+{
+    const float indexInit[4] = { 0.0f, 0.0f, 1.0f, 1.0f };
+    const float32x4_t g = vdupq_n_f32(gain);
+    const float32x4_t step = vdupq_n_f32(gainStep);
+    float32x4_t index = vld1q_f32(indexInit);
+    const float32x4_t two = vdupq_n_f32(2.0f);
+    size_t i = 0;
+    for (; i + 2 <= nBlocks; i += 2) {
+        float *out = buffer + i * N_CHANNELS;
+        float32x4_t gains = vaddq_f32(g, vmulq_f32(index, step));
+        index = vaddq_f32(index, two);
+        vst1q_f32(out, vmulq_f32(vld1q_f32(out), gains));
+    }
+    return gainRampTail(buffer, i, nBlocks, gain, gainStep);
+}
+
+static void accumulateNEON(float *dst, const float *src, size_t nElements)
+{
+    size_t i = 0;
+    for (; i + 4 <= nElements; i += 4)
+        vst1q_f32(dst + i, vaddq_f32(vld1q_f32(dst + i), vld1q_f32(src + i)));
+    accumulateScalar(dst + i, src + i, nElements - i);
+}
+
+static void weightedSquaresNEON(const float *audio, const float *weights, size_t nBlocks,
+        float& left, float& right)
+{
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 2 <= nBlocks; i += 2) {
+        float32x2_t w2 = vld1_f32(weights + i);
+        float32x4_t w = vcombine_f32(vdup_lane_f32(w2, 0), vdup_lane_f32(w2, 1));
+        float32x4_t a = vld1q_f32(audio + i * N_CHANNELS);
+        acc = vaddq_f32(acc, vmulq_f32(w, vmulq_f32(a, a)));
+    }
+    float lanes[4];
+    vst1q_f32(lanes, acc);
+    float l = lanes[0] + lanes[2];
+    float r = lanes[1] + lanes[3];
+    for (; i < nBlocks; i++) {
+        l += weights[i] * audio[i * N_CHANNELS] * audio[i * N_CHANNELS];
+        r += weights[i] * audio[i * N_CHANNELS + 1] * audio[i * N_CHANNELS + 1];
+    }
+    left = l;
+    right = r;
+}
+
+static float interpolatedFirNEON(const float *src, const float *kernel, const float *next, float frac, size_t nTaps)
+{
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 4 <= nTaps; i += 4) {
+        float32x4_t k = vld1q_f32(kernel + i);
+        k = vmlaq_n_f32(k, vsubq_f32(vld1q_f32(next + i), k), frac);
+        acc = vmlaq_f32(acc, vld1q_f32(src + i), k);
+    }
+    float lanes[4];
+    vst1q_f32(lanes, acc);
+    float sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    return sum + interpolatedFirScalar(src + i, kernel + i, next + i, frac, nTaps - i);
+}
+
+static const MixKernels::KernelSet neonKernels = {
+    "neon", mixMonoRampNEON, gainRampNEON, accumulateNEON, weightedSquaresNEON, interpolatedFirNEON
+};
+
+#endif // MIX_KERNELS_NEON
+
+/*
+ * dispatch
+ */
+
+// supported kernel sets, best first
+static vector<const MixKernels::KernelSet *> supportedKernels()
+{
+    vector<const MixKernels::KernelSet *> sets;
+#ifdef MIX_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        sets.push_back(&avx2Kernels);
+    if (__builtin_cpu_supports("sse2"))
+        sets.push_back(&sse2Kernels);
+#endif
+#ifdef MIX_KERNELS_NEON
+    sets.push_back(&neonKernels);
+#endif
+    sets.push_back(&scalarKernels);
+    return sets;
+}
+
+const MixKernels::KernelSet *MixKernels::kernels = supportedKernels().front();
+
+void MixKernels::MixMonoRamp(float *dst, const float *src, size_t nBlocks,
+        float lVol, float rVol, float lVolStep, float rVolStep)
+{
+    kernels->mixMonoRamp(dst, src, nBlocks, lVol, rVol, lVolStep, rVolStep);
+}
+
+float MixKernels::GainRamp(float *buffer, size_t nBlocks, float gain, float gainStep)
+{
+    return kernels->gainRamp(buffer, nBlocks, gain, gainStep);
+}
+
+void MixKernels::Accumulate(float *dst, const float *src, size_t nElements)
+{
+    kernels->accumulate(dst, src, nElements);
+}
+
+void MixKernels::WeightedSquares(const float *audio, const float *weights, size_t nBlocks,
+        float& left, float& right)
+{
+    kernels->weightedSquares(audio, weights, nBlocks, left, right);
+}
+
+float MixKernels::InterpolatedFir(const float *src, const float *kernel, const float *next, float frac, size_t nTaps)
+{
+    return kernels->interpolatedFir(src, kernel, next, frac, nTaps);
+}
+
+const char *MixKernels::GetInstructionSet()
+{
+    return kernels->name;
+}
+
+bool MixKernels::SetInstructionSet(const string& name)
+{
+    for (const KernelSet *set : supportedKernels()) {
+        if (name == set->name) {
+            kernels = set;
+            return true;
+        }
+    }
+    return false;
+}
+
+vector<string> MixKernels::GetSupportedInstructionSets()
+{
+    vector<string> names;
+    for (const KernelSet *set : supportedKernels())
+        names.push_back(set->name);
+    return names;
+}
+
+float MixKernels::SelfTest(const string& name)
+{
+    for (const KernelSet *set : supportedKernels()) {
+        if (name == set->name)
+            return testKernels(*set);
+    }
+    return -1.0f;
+}
+
+float MixKernels::SelfTest()
+{
+    float maxError = 0.0f;
+    for (const KernelSet *set : supportedKernels())
+        maxError = max(maxError, testKernels(*set));
+    return maxError;
+}
+
+/*
+ * private MixKernels
+ */
+
+float MixKernels::testKernels(const KernelSet& set)
+{
+    // odd lengths make sure the remaining blocks are handled as well
+    const size_t nBlocks = 803;
+    mt19937 rng(1);
+    uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    vector<float> src(nBlocks), weights(nBlocks), audio(nBlocks * N_CHANNELS);
+    for (float& f : src)
+        f = dist(rng);
+    for (float& f : weights)
+        f = 0.5f * (dist(rng) + 1.0f);
+    for (float& f : audio)
+        f = dist(rng);
+
+    float maxError = 0.0f;
+    auto compare = [&](const vector<float>& ref, const vector<float>& test) {
+        for (size_t i = 0; i < ref.size(); i++) {
+            float error = fabsf(ref[i] - test[i]) / max(fabsf(ref[i]), 1.0f);
+            maxError = max(maxError, error);
+        }
+    };
+
+    vector<float> ref(audio), test(audio);
+    scalarKernels.mixMonoRamp(ref.data(), src.data(), nBlocks, 0.1f, 0.9f, 0.001f, -0.0007f);
+    set.mixMonoRamp(test.data(), src.data(), nBlocks, 0.1f, 0.9f, 0.001f, -0.0007f);
+    compare(ref, test);
+
+    ref = test = audio;
+    scalarKernels.gainRamp(ref.data(), nBlocks, 1.0f, -1.0f / float(nBlocks));
+    set.gainRamp(test.data(), nBlocks, 1.0f, -1.0f / float(nBlocks));
+    compare(ref, test);
+
+    ref = test = audio;
+    scalarKernels.accumulate(ref.data(), src.data(), src.size());
+    set.accumulate(test.data(), src.data(), src.size());
+    compare(ref, test);
+
+    vector<float> refSums(2), testSums(2);
+    scalarKernels.weightedSquares(audio.data(), weights.data(), nBlocks, refSums[0], refSums[1]);
+    set.weightedSquares(audio.data(), weights.data(), nBlocks, testSums[0], testSums[1]);
+    compare(refSums, testSums);
+
+    vector<float> refFir(1), testFir(1);
+    for (size_t taps : {32, 35}) {
+        refFir[0] = scalarKernels.interpolatedFir(src.data(), weights.data(), audio.data(), 0.3f, taps);
+        testFir[0] = set.interpolatedFir(src.data(), weights.data(), audio.data(), 0.3f, taps);
+        compare(refFir, testFir);
+    }
+
+    return maxError;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// largest relative error of the vectorized kernels that SelfTest accepts
+#define MIX_KERNELS_TOLERANCE 1e-4f
+
+namespace agbplay
+{
+    /*
+     * Inner loops of the mixer with SIMD implementations. The fastest
+     * instruction set the CPU supports (AVX2 or SSE2 on x86, NEON on ARM)
+     * is picked at startup, so the same binary runs on every CPU.
+     * The plain C++ versions are the reference, the vectorized ones only
+     * differ by rounding because they don't accumulate the volume ramps.
+     */
+    class MixKernels
+    {
+        public:
+            // stereo dst += mono src * volume, the volume ramps by lVolStep/rVolStep per block
+            static void MixMonoRamp(float *dst, const float *src, size_t nBlocks,
+                    float lVol, float rVol, float lVolStep, float rVolStep);
+            // stereo buffer *= gain, the gain ramps by gainStep per block, returns the gain of the next block
+            static float GainRamp(float *buffer, size_t nBlocks, float gain, float gainStep);
+            // dst += src
+            static void Accumulate(float *dst, const float *src, size_t nElements);
+            // sums of the weighted squares of the left and right samples
+            static void WeightedSquares(const float *audio, const float *weights, size_t nBlocks,
+                    float& left, float& right);
+            // FIR filter output for a phase between two kernels: sum of src[i] * (kernel[i] + frac * (next[i] - kernel[i]))
+            static float InterpolatedFir(const float *src, const float *kernel, const float *next, float frac, size_t nTaps);
+
+            // "scalar", "sse2", "avx2" or "neon"
+            static const char *GetInstructionSet();
+            // returns false if the instruction set isn't known or not supported by the CPU
+            static bool SetInstructionSet(const std::string& name);
+            // every instruction set the CPU supports, best first
+            static std::vector<std::string> GetSupportedInstructionSets();
+            // compares the kernels of a supported instruction set to the scalar ones on random data,
+            // returns the largest relative error or a negative value if the set isn't supported
+            static float SelfTest(const std::string& name);
+            // SelfTest of every supported instruction set, returns the largest error of all of them
+            static float SelfTest();
+
+            struct KernelSet
+            {
+                const char *name;
+                void (*mixMonoRamp)(float *, const float *, size_t, float, float, float, float);
+                float (*gainRamp)(float *, size_t, float, float);
+                void (*accumulate)(float *, const float *, size_t);
+                void (*weightedSquares)(const float *, const float *, size_t, float&, float&);
+                float (*interpolatedFir)(const float *, const float *, const float *, float, size_t);
+            };
+        private:
+            static float testKernels(const KernelSet& set);
+
+            static const KernelSet *kernels;
+    };
+}
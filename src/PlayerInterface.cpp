@@ -3,25 +3,38 @@
 #include <cstdlib>
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 
 #include "PlayerInterface.h"
 #include "Xcept.h"
 #include "Debug.h"
 #include "Util.h"
 #include "ConfigManager.h"
+#include "RenderCache.h"
+#include "SoundExporter.h"
 
 using namespace std;
 using namespace agbplay;
 
 #define MAX_LOOPS 255
 
+// about 1/24 s of audio, rounded up to a power of two
+static size_t streamBufferSize(uint32_t sampleRate)
+{
+    size_t size = 1;
+    while (size < sampleRate / 24)
+        size <<= 1;
+    return size;
+}
+
 /*
  * public PlayerInterface
  */
 
 PlayerInterface::PlayerInterface(Rom& _rom, TrackviewGUI *trackUI, long initSongPos) 
     : rom(_rom), seq(initSongPos, ConfigManager::Instance().GetCfg().GetTrackLimit(), _rom), 
-    rBuf(N_CHANNELS * STREAM_BUF_SIZE), masterLoudness(10.f), mutedTracks(ConfigManager::Instance().GetCfg().GetTrackLimit())
+    sampleRate(playbackSampleRate()), rBuf(N_CHANNELS * streamBufferSize(sampleRate)),
+    masterLoudness(MASTER_METER_FREQ, sampleRate), mutedTracks(ConfigManager::Instance().GetCfg().GetTrackLimit())
 {
     this->trackUI = trackUI;
     playerState = State::THREAD_DELETED;
@@ -31,13 +44,13 @@ PlayerInterface::PlayerInterface(Rom& _rom, TrackviewGUI *trackUI, long initSong
     sg = new StreamGenerator(seq, 
             EnginePars(gameCfg.GetPCMVol(), gameCfg.GetEngineRev(), gameCfg.GetEngineFreq()), 
             MAX_LOOPS, float(speedFactor) / 64.0f, 
-            gameCfg.GetRevType());
-    setupLoudnessCalcs();
+            gameCfg.GetRevType(), sampleRate);
+    renderingAudio = false;
+    findCachedAudio(initSongPos);
     // start audio stream
     PaError err;
     //uint32_t nBlocks = sg->GetBufferUnitCount();
-    uint32_t outSampleRate = sg->GetRenderSampleRate();
-    if ((err = Pa_OpenDefaultStream(&audioStream, 0, N_CHANNELS, paFloat32, outSampleRate, /*nBlocks * N_CHANNELS*/0, audioCallback, (void *)&rBuf)) != paNoError) {
+    if ((err = Pa_OpenDefaultStream(&audioStream, 0, N_CHANNELS, paFloat32, sampleRate, /*nBlocks * N_CHANNELS*/0, audioCallback, (void *)&rBuf)) != paNoError) {
         _print_debug("Pa_OpenDefaultStream: %s", Pa_GetErrorText(err));
         return;
     }
@@ -67,7 +80,7 @@ void PlayerInterface::LoadSong(long songPos)
     Stop();
     GameConfig& gameCfg = ConfigManager::Instance().GetCfg();
     seq = Sequence(songPos, gameCfg.GetTrackLimit(), rom);
-    setupLoudnessCalcs();
+    findCachedAudio(songPos);
     float vols[seq.tracks.size() * N_CHANNELS];
     for (size_t i = 0; i < seq.tracks.size() * N_CHANNELS; i++)
         vols[i] = 0.0f;
@@ -78,7 +91,7 @@ void PlayerInterface::LoadSong(long songPos)
                 gameCfg.GetEngineRev(), 
                 gameCfg.GetEngineFreq()), 
             MAX_LOOPS, float(speedFactor) / 64.0f, 
-            gameCfg.GetRevType());
+            gameCfg.GetRevType(), sampleRate);
     if (play)
         Play();
 }
@@ -165,7 +178,7 @@ void PlayerInterface::Stop()
             delete playerThread;
             playerState = State::THREAD_DELETED;
             delete sg;
-            sg = new StreamGenerator(seq, EnginePars(gameCfg.GetPCMVol(), gameCfg.GetEngineRev(), gameCfg.GetEngineFreq()), MAX_LOOPS, float(speedFactor) / 64.0f, gameCfg.GetRevType());
+            sg = new StreamGenerator(seq, EnginePars(gameCfg.GetPCMVol(), gameCfg.GetEngineRev(), gameCfg.GetEngineFreq()), MAX_LOOPS, float(speedFactor) / 64.0f, gameCfg.GetRevType(), sampleRate);
             break;            
         case State::THREAD_DELETED:
             // ignore this
@@ -200,10 +213,13 @@ void PlayerInterface::UpdateView()
             playerState != State::SHUTDOWN &&
             playerState != State::TERMINATED) {
         size_t trks = sg->GetWorkingSequence().tracks.size();
-        assert(trks == trackLoudness.size());
         float vols[trks * N_CHANNELS];
-        for (size_t i = 0; i < trks; i++)
-            trackLoudness[i].GetLoudness(vols[i*N_CHANNELS], vols[i*N_CHANNELS+1]);
+        for (size_t i = 0; i < trks; i++) {
+            if (renderingAudio)
+                sg->GetTrackLoudness(uint8_t(i), vols[i*N_CHANNELS], vols[i*N_CHANNELS+1]);
+            else
+                vols[i*N_CHANNELS] = vols[i*N_CHANNELS+1] = 0.0f;
+        }
         trackUI->SetState(sg->GetWorkingSequence(), vols, int(sg->GetActiveChannelCount()), -1);
     }
 }
@@ -220,7 +236,11 @@ void PlayerInterface::Mute(size_t index, bool mute)
 
 void PlayerInterface::GetMasterVolLevels(float& left, float& right)
 {
-    masterLoudness.GetLoudness(left, right);
+    // the generator meters the rendered audio, the cached audio is metered here
+    if (renderingAudio)
+        sg->GetMasterLoudness(left, right);
+    else
+        masterLoudness.GetLoudness(left, right);
 }
 
 /*
@@ -233,36 +253,65 @@ void PlayerInterface::threadWorker()
     size_t nBlocks = sg->GetBufferUnitCount();
     vector<float> silence(nBlocks * N_CHANNELS, 0.0f);
     vector<float> audio(nBlocks * N_CHANNELS, 0.0f);
+    SNDFILE *cached = openCachedAudio();
+    // the player only needs the mixdown and the meters
+    sg->SetStemOutput(false);
+    sg->SetMetering(true);
+    sg->SetSkipAudio(cached != nullptr);
+    renderingAudio = cached == nullptr;
     try {
         // FIXME seems to still have an issue with a race condition and default case occuring
         while (playerState != State::SHUTDOWN) {
             switch (playerState) {
                 case State::RESTART:
                     delete sg;
-                    sg = new StreamGenerator(seq, EnginePars(gameCfg.GetPCMVol(), gameCfg.GetEngineRev(), gameCfg.GetEngineFreq()), MAX_LOOPS, float(speedFactor) / 64.0f, gameCfg.GetRevType());
+                    sg = new StreamGenerator(seq, EnginePars(gameCfg.GetPCMVol(), gameCfg.GetEngineRev(), gameCfg.GetEngineFreq()), MAX_LOOPS, float(speedFactor) / 64.0f, gameCfg.GetRevType(), sampleRate);
+                    sg->SetStemOutput(false);
+                    sg->SetMetering(true);
+                    if (cached)
+                        sf_close(cached);
+                    cached = openCachedAudio();
+                    sg->SetSkipAudio(cached != nullptr);
+                    renderingAudio = cached == nullptr;
                     playerState = State::PLAYING;
                 case State::PLAYING:
-                    {
-                        // clear high level mixing buffer
-                        fill(audio.begin(), audio.end(), 0.0f);
-                        // render audio buffers for tracks
-                        vector<vector<float>>& raudio = sg->ProcessAndGetAudio();
-                        for (size_t i = 0; i < raudio.size(); i++) {
-                            assert(raudio[i].size() == audio.size());
-
-                            bool muteThis = mutedTracks[i];
-                            sg->GetWorkingSequence().tracks[i].muted = muteThis;
-                            trackLoudness[i].CalcLoudness(raudio[i].data(), nBlocks);
-                            if (muteThis)
-                                continue;
-
-                            for (size_t j = 0; j < audio.size(); j++) {
-                                audio[j] += raudio[i][j];
-                            }
-                        }
-                        // blocking write to audio buffer
+                    // the cached mixdown only matches a render at normal speed with all tracks
+                    if (cached && (speedFactor != 64 || find(mutedTracks.begin(), mutedTracks.end(), true) != mutedTracks.end())) {
+                        sf_close(cached);
+                        cached = nullptr;
+                        sg->SetSkipAudio(false);
+                        renderingAudio = true;
+                    }
+                    if (cached) {
+                        // the generator follows the song without audio so that the track view and
+                        // live rendering can take over at the same position
+                        sg->ProcessAndGetAudio();
+                        sf_count_t frames = sf_readf_float(cached, audio.data(), sf_count_t(nBlocks));
+                        if (frames < 0)
+                            frames = 0;
+                        fill(audio.begin() + frames * N_CHANNELS, audio.end(), 0.0f);
                         rBuf.Put(audio.data(), audio.size());
                         masterLoudness.CalcLoudness(audio.data(), nBlocks);
+                        // the export starts fading out where the generator loops once more than the export,
+                        // songs without loop end in both at the same time
+                        if (size_t(frames) < nBlocks || sg->GetLoopCount() > EXPORT_MAX_LOOPS) {
+                            sf_close(cached);
+                            cached = nullptr;
+                            sg->SetSkipAudio(false);
+                            renderingAudio = true;
+                            if (sg->HasStreamEnded())
+                                playerState = State::SHUTDOWN;
+                        }
+                    } else {
+                        // the generator leaves out muted tracks and meters all tracks in its output stage
+                        Sequence& wseq = sg->GetWorkingSequence();
+                        for (size_t i = 0; i < wseq.tracks.size(); i++)
+                            wseq.tracks[i].muted = mutedTracks[i];
+                        sg->ProcessAndGetAudio();
+                        vector<float>& master = sg->GetMasterAudio();
+                        assert(master.size() == audio.size());
+                        // blocking write to audio buffer
+                        rBuf.Put(master.data(), master.size());
                         if (sg->HasStreamEnded()) {
                             playerState = State::SHUTDOWN;
                             break;
@@ -279,9 +328,10 @@ void PlayerInterface::threadWorker()
     } catch (exception& e) {
         _print_debug("FATAL ERROR on streaming thread: %s", e.what());
     }
+    if (cached)
+        sf_close(cached);
+    renderingAudio = false;
     masterLoudness.Reset();
-    for (LoudnessCalculator& c : trackLoudness)
-        c.Reset();
     // flush buffer
     rBuf.Clear();
     playerState = State::TERMINATED;
@@ -298,9 +348,50 @@ int PlayerInterface::audioCallback(const void *inputBuffer, void *outputBuffer,
     return 0;
 }
 
-void PlayerInterface::setupLoudnessCalcs()
+uint32_t PlayerInterface::playbackSampleRate()
 {
-    trackLoudness.clear();
-    for (size_t i = 0; i < seq.tracks.size(); i++)
-        trackLoudness.emplace_back(5.0f);
+    // rendering at the rate of the device saves resampling in PortAudio or the OS
+    uint32_t rate = ConfigManager::Instance().GetCfg().GetSampleRate();
+    if (rate == 0) {
+        rate = STREAM_SAMPLERATE;
+        PaDeviceIndex dev = Pa_GetDefaultOutputDevice();
+        const PaDeviceInfo *info = dev == paNoDevice ? nullptr : Pa_GetDeviceInfo(dev);
+        if (info != nullptr && info->defaultSampleRate > 0.0)
+            rate = uint32_t(lround(info->defaultSampleRate));
+    }
+    rate = clip<uint32_t>(MIN_SAMPLERATE, rate, MAX_SAMPLERATE);
+    _print_debug("Playback sample rate: %u Hz", rate);
+    return rate;
+}
+
+void PlayerInterface::findCachedAudio(long songPos)
+{
+    cachedAudio.clear();
+    const string& cacheDir = ConfigManager::Instance().GetCfg().GetRenderCache();
+    if (cacheDir.empty())
+        return;
+    try {
+        Rom songRom(rom);
+        RenderCache cache(cacheDir);
+        // exports end with a fade after fewer loops than the player plays, see threadWorker
+        cachedAudio = cache.GetPlaybackFile(songRom, songPos, sampleRate, EXPORT_MAX_LOOPS);
+    } catch (exception& e) {
+        _print_debug("Render cache: %s", e.what());
+    }
+}
+
+SNDFILE *PlayerInterface::openCachedAudio()
+{
+    if (cachedAudio.empty())
+        return nullptr;
+    SF_INFO info;
+    memset(&info, 0, sizeof(info));
+    SNDFILE *file = sf_open(cachedAudio.c_str(), SFM_READ, &info);
+    if (file == nullptr)
+        return nullptr;
+    if (info.channels != N_CHANNELS || info.samplerate != int(sampleRate)) {
+        sf_close(file);
+        return nullptr;
+    }
+    return file;
 }
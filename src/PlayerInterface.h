@@ -3,7 +3,9 @@
 #include <cstdint>
 #include <vector>
 #include <thread>
+#include <string>
 #include <portaudio.h>
+#include <sndfile.h>
 
 #include "Rom.h"
 #include "TrackviewGUI.h"
@@ -40,7 +42,9 @@ namespace agbplay
                     const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags,
                     void *userData);
 
-            void setupLoudnessCalcs();
+            static uint32_t playbackSampleRate();
+            void findCachedAudio(long songPos);
+            SNDFILE *openCachedAudio();
 
             PaStream *audioStream;
             uint32_t speedFactor; // 64 = normal
@@ -49,11 +53,16 @@ namespace agbplay
             Sequence seq;
             StreamGenerator *sg;
             TrackviewGUI *trackUI;
+            // chosen once, the audio stream and all generators use it
+            uint32_t sampleRate;
             Ringbuffer rBuf;
 
+            // meters the cached audio, rendered audio is metered by the generator
             LoudnessCalculator masterLoudness;
-            std::vector<LoudnessCalculator> trackLoudness;
+            volatile bool renderingAudio;
             std::vector<bool> mutedTracks;
+            // rendered mixdown from the render cache, streamed instead of rendering the song
+            std::string cachedAudio;
 
             std::thread *playerThread;
     };
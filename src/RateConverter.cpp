@@ -0,0 +1,61 @@
+#include <algorithm>
+#include <cassert>
+
+#include "RateConverter.h"
+
+using namespace std;
+using namespace agbplay;
+
+/*
+ * public RateConverter
+ */
+
+RateConverter::RateConverter()
+    : RateConverter(1, 1)
+{
+}
+
+RateConverter::RateConverter(size_t inBlocks, size_t outBlocks)
+{
+    this->inBlocks = inBlocks;
+    this->outBlocks = outBlocks;
+    // the windows of a frame reach up to WindowTaps samples past the frame start, zeros in front of
+    // the first input make up for that; the latency is the smallest whole number of output samples
+    // that needs enough zeros, the phase takes the fraction of an input sample
+    size_t taps = SincResampler::WindowTaps();
+    size_t center = SincResampler::WindowCenter();
+    latency = (taps - center - 1) * outBlocks / inBlocks + 1;
+    size_t offset = (latency * inBlocks + outBlocks - 1) / outBlocks;
+    phaseNum = offset * outBlocks - latency * inBlocks;
+    for (size_t ch = 0; ch < N_CHANNELS; ch++) {
+        float *prefill = pending[ch].Append(center + offset);
+        fill(prefill, prefill + center + offset, 0.0f);
+    }
+}
+
+void RateConverter::Process(float *out, const float *in)
+{
+    float outBuffer[outBlocks];
+    size_t nextPhaseNum = phaseNum;
+    for (size_t ch = 0; ch < N_CHANNELS; ch++) {
+        FetchBuffer& p = pending[ch];
+        float *dest = p.Append(inBlocks);
+        for (size_t i = 0; i < inBlocks; i++)
+            dest[i] = in[i * N_CHANNELS + ch];
+
+        // both channels start at the same phase
+        nextPhaseNum = phaseNum;
+        size_t consumed = resampler.ProcessRatio(outBuffer, outBlocks, p.Data(), nextPhaseNum, inBlocks, outBlocks);
+        // a frame always moves by exactly inBlocks, so the zeros in front keep every window covered
+        assert(consumed == inBlocks && p.Size() >= consumed + SincResampler::WindowTaps());
+        p.Consume(consumed);
+        for (size_t i = 0; i < outBlocks; i++)
+            out[i * N_CHANNELS + ch] = outBuffer[i];
+    }
+    phaseNum = nextPhaseNum;
+}
+
+size_t RateConverter::GetLatency() const
+{
+    return latency;
+}
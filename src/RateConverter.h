@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+#include "Resampler.h"
+#include "Constants.h"
+
+namespace agbplay
+{
+    /*
+     * Converts an interleaved stereo stream frame by frame, each input frame
+     * of inBlocks becomes an output frame of outBlocks. Both frames last equally
+     * long, so the phase is tracked exactly and never drifts. The sinc filter
+     * looks ahead, so the output is delayed by GetLatency output samples.
+     */
+    class RateConverter
+    {
+        public:
+            // 1:1, only a placeholder until a real converter is assigned
+            RateConverter();
+            RateConverter(size_t inBlocks, size_t outBlocks);
+
+            // reads inBlocks from in and writes outBlocks to out
+            void Process(float *out, const float *in);
+            // delay of the output in output samples
+            size_t GetLatency() const;
+        private:
+            SincResampler resampler;
+            // input samples the filter still reads
+            FetchBuffer pending[N_CHANNELS];
+            size_t inBlocks;
+            size_t outBlocks;
+            // position of the next output between two input samples in units of 1 / outBlocks
+            size_t phaseNum;
+            size_t latency;
+    };
+}
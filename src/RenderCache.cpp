@@ -0,0 +1,226 @@
+#define BOOST_FILESYSTEM_NO_DEPRECATED
+#include <boost/filesystem.hpp>
+#undef BOOST_FILESYSTEM_NO_DEPRECATED
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "RenderCache.h"
+#include "SoundData.h"
+#include "ConfigManager.h"
+#include "MixKernels.h"
+#include "Constants.h"
+#include "Util.h"
+#include "Xcept.h"
+#include "Debug.h"
+
+using namespace std;
+using namespace agbplay;
+namespace fs = boost::filesystem;
+
+// increase whenever a change to the engine changes the rendered audio
+#define RENDER_CACHE_VERSION 5
+#define INSTRUMENT_SIZE 12
+#define NUM_INSTRUMENTS 128
+
+/*
+ * public RenderCache
+ */
+
+RenderCache::RenderCache(const string& cacheDir)
+{
+    this->cacheDir = cacheDir;
+    boost::system::error_code ec;
+    fs::create_directories(cacheDir, ec);
+    if (ec)
+        throw Xcept("Creating render cache directory failed: %s", ec.message().c_str());
+}
+
+RenderCache::~RenderCache()
+{
+}
+
+string RenderCache::GetKey(Rom& rom, long songPos, uint32_t sampleRate, uint8_t maxLoops, const string& variant)
+{
+    uint64_t hash = SongTable::HashSong(rom, songPos);
+    rom.Seek(songPos + 4);
+    agbptr_t bankPtr = rom.ReadUInt32();
+    if (rom.ValidPointer(bankPtr))
+        hashVoicegroup(rom, rom.AGBPtrToPos(bankPtr), hash, true);
+
+    GameConfig& cfg = ConfigManager::Instance().GetCfg();
+    uint32_t params[] = {
+        RENDER_CACHE_VERSION,
+        sampleRate,
+        maxLoops,
+        cfg.GetPCMVol(),
+        cfg.GetEngineFreq(),
+        cfg.GetEngineRev(),
+        uint32_t(cfg.GetRevType()),
+        uint32_t(cfg.GetResType()),
+        uint32_t(cfg.GetResTypeFixed()),
+        cfg.GetTrackLimit(),
+        cfg.GetPCMVoiceLimit(),
+        cfg.GetRevBufSize(),
+        cfg.GetMono(),
+        cfg.GetEngineRateMix(),
+    };
+    HashBytes(hash, params, sizeof(params));
+    HashBytes(hash, variant.data(), variant.size());
+    // the mixing kernels only agree up to rounding, so each set gets its own entries
+    const char *kernelSet = MixKernels::GetInstructionSet();
+    HashBytes(hash, kernelSet, strlen(kernelSet));
+
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", (unsigned long long)hash);
+    return key;
+}
+
+bool RenderCache::Fetch(const string& key, const string& outputBase, vector<string>& files)
+{
+    vector<string> suffixes;
+    if (!readEntry(key, suffixes))
+        return false;
+    vector<string> fetched;
+    for (const string& suffix : suffixes) {
+        if (!linkFile(cacheDir + "/" + key + suffix, outputBase + suffix))
+            return false;
+        fetched.push_back(outputBase + suffix);
+    }
+    files.insert(files.end(), fetched.begin(), fetched.end());
+    return true;
+}
+
+void RenderCache::Store(const string& key, const string& outputBase, const vector<string>& files)
+{
+    vector<string> suffixes;
+    for (const string& file : files) {
+        string suffix = file.substr(outputBase.size());
+        if (!replaceFile(file, cacheDir + "/" + key + suffix)) {
+            _print_debug("Warning: Couldn't add \"%s\" to the render cache", file.c_str());
+            return;
+        }
+        suffixes.push_back(suffix);
+    }
+
+    // the file list is written last, so incomplete entries are never used
+    string entryName = cacheDir + "/" + key + ".files";
+    string tmpName = entryName + "." + fs::unique_path().string() + ".tmp";
+    {
+        ofstream entry(tmpName);
+        for (const string& suffix : suffixes)
+            entry << suffix << endl;
+        if (!entry) {
+            _print_debug("Warning: Couldn't write render cache entry %s", entryName.c_str());
+            return;
+        }
+    }
+    boost::system::error_code ec;
+    fs::rename(tmpName, entryName, ec);
+    if (ec) {
+        _print_debug("Warning: Couldn't write render cache entry %s: %s", entryName.c_str(), ec.message().c_str());
+        fs::remove(tmpName, ec);
+    }
+}
+
+string RenderCache::GetPlaybackFile(Rom& rom, long songPos, uint32_t sampleRate, uint8_t maxLoops)
+{
+    string key = GetKey(rom, songPos, sampleRate, maxLoops, RENDER_CACHE_PLAYBACK_VARIANT);
+    vector<string> suffixes;
+    if (!readEntry(key, suffixes) || find(suffixes.begin(), suffixes.end(), ".wav") == suffixes.end())
+        return "";
+    return cacheDir + "/" + key + ".wav";
+}
+
+/*
+ * private RenderCache
+ */
+
+bool RenderCache::readEntry(const string& key, vector<string>& suffixes)
+{
+    ifstream entry(cacheDir + "/" + key + ".files");
+    if (!entry.is_open())
+        return false;
+    string suffix;
+    while (getline(entry, suffix)) {
+        if (!suffix.empty())
+            suffixes.push_back(suffix);
+    }
+    return !suffixes.empty();
+}
+
+bool RenderCache::linkFile(const string& from, const string& to)
+{
+    boost::system::error_code ec;
+    fs::remove(to, ec);
+    fs::create_hard_link(from, to, ec);
+    if (!ec)
+        return true;
+    // hardlinks don't work across file systems
+    fs::copy_file(from, to, ec);
+    return !ec;
+}
+
+bool RenderCache::replaceFile(const string& from, const string& to)
+{
+    string tmpName = to + "." + fs::unique_path().string() + ".tmp";
+    if (!linkFile(from, tmpName))
+        return false;
+    boost::system::error_code ec;
+    fs::rename(tmpName, to, ec);
+    if (!ec)
+        return true;
+    fs::remove(tmpName, ec);
+    return false;
+}
+
+void RenderCache::hashVoicegroup(Rom& rom, long bankPos, uint64_t& hash, bool subTables)
+{
+    for (long i = 0; i < NUM_INSTRUMENTS; i++) {
+        long pos = bankPos + i * INSTRUMENT_SIZE;
+        if (pos + INSTRUMENT_SIZE > (long)rom.Size())
+            break;
+        HashBytes(hash, &rom[pos], INSTRUMENT_SIZE);
+        uint8_t type = rom[pos];
+        agbptr_t ptr4 = *(agbptr_t *)&rom[pos + 4];
+        agbptr_t ptr8 = *(agbptr_t *)&rom[pos + 8];
+        switch (type) {
+            case 0x0:
+            case 0x8:
+                // PCM sample, 16 byte header followed by the sample data
+                if (rom.ValidPointer(ptr4) && rom.AGBPtrToPos(ptr4) + 16 <= (long)rom.Size())
+                    hashData(rom, ptr4, 16 + *(uint32_t *)&rom[rom.AGBPtrToPos(ptr4) + 12], hash);
+                break;
+            case 0x3:
+            case 0xB:
+                // 4 bit wave data
+                hashData(rom, ptr4, 16, hash);
+                break;
+            case 0x40:
+                // key split
+                if (subTables) {
+                    hashData(rom, ptr8, NUM_NOTES, hash);
+                    if (rom.ValidPointer(ptr4))
+                        hashVoicegroup(rom, rom.AGBPtrToPos(ptr4), hash, false);
+                }
+                break;
+            case 0x80:
+                // every key split (drums)
+                if (subTables && rom.ValidPointer(ptr4))
+                    hashVoicegroup(rom, rom.AGBPtrToPos(ptr4), hash, false);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void RenderCache::hashData(Rom& rom, agbptr_t ptr, size_t len, uint64_t& hash)
+{
+    if (!rom.ValidPointer(ptr))
+        return;
+    long pos = rom.AGBPtrToPos(ptr);
+    len = min(len, rom.Size() - size_t(pos));
+    HashBytes(hash, &rom[pos], len);
+}
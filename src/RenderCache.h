@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "Rom.h"
+
+// exports with these settings produce a mixdown the player can stream
+#define RENDER_CACHE_PLAYBACK_VARIANT "mixdown wav"
+
+namespace agbplay
+{
+    /*
+     * On disk cache of rendered songs. Entries are keyed by a hash of all ROM
+     * data a song can reach (header, tracks, voicegroup, samples), every
+     * engine setting of the game config and the export settings (variant),
+     * so renaming songs or changing unrelated settings keeps the cache valid.
+     */
+    class RenderCache
+    {
+        public:
+            RenderCache(const std::string& cacheDir);
+            ~RenderCache();
+
+            // maxLoops is the loop count of the StreamGenerator, renders with other counts differ in length
+            std::string GetKey(Rom& rom, long songPos, uint32_t sampleRate, uint8_t maxLoops, const std::string& variant);
+            // hardlinks (or copies) the cached files to outputBase + suffix, returns false on a cache miss
+            bool Fetch(const std::string& key, const std::string& outputBase, std::vector<std::string>& files);
+            // adds the files outputBase + suffix as cache entry
+            void Store(const std::string& key, const std::string& outputBase, const std::vector<std::string>& files);
+            // cached float WAV mixdown for playback, empty if there is none
+            std::string GetPlaybackFile(Rom& rom, long songPos, uint32_t sampleRate, uint8_t maxLoops);
+        private:
+            bool readEntry(const std::string& key, std::vector<std::string>& suffixes);
+            static bool linkFile(const std::string& from, const std::string& to);
+            // writes through a temporary file, so concurrent exports of the same song never see a partial file
+            static bool replaceFile(const std::string& from, const std::string& to);
+            static void hashVoicegroup(Rom& rom, long bankPos, uint64_t& hash, bool subTables);
+            static void hashData(Rom& rom, agbptr_t ptr, size_t len, uint64_t& hash);
+
+            std::string cacheDir;
+    };
+}
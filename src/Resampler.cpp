@@ -1,26 +1,206 @@
 #include <boost/math/special_functions/sinc.hpp>
+#include <cmath>
+#include <algorithm>
+#include <cassert>
 
 #include "Resampler.h"
+#include "MixKernels.h"
 #include "Util.h"
 #include "Debug.h"
 
+FetchBuffer::FetchBuffer()
+{
+    start = 0;
+    end = 0;
+}
+
+size_t FetchBuffer::Size() const
+{
+    return end - start;
+}
+
+float *FetchBuffer::Data()
+{
+    return samples.data() + start;
+}
+
+float *FetchBuffer::Append(size_t n)
+{
+    if (end + n > samples.size()) {
+        // move the unconsumed samples to the front, copying forward is fine as they only move down
+        if (start > 0) {
+            std::copy(samples.begin() + long(start), samples.begin() + long(end), samples.begin());
+            end -= start;
+            start = 0;
+        }
+        // twice the size needed so that the next few calls fit without moving anything
+        if (end + n > samples.size())
+            samples.resize(2 * (end + n));
+    }
+    float *dest = samples.data() + end;
+    end += n;
+    return dest;
+}
+
+void FetchBuffer::Consume(size_t n)
+{
+    assert(n <= end - start);
+    start += n;
+}
+
+void FetchBuffer::Clear()
+{
+    start = 0;
+    end = 0;
+}
+
+SampleStream::SampleStream()
+{
+    Init(nullptr, nullptr, 0, 0, false);
+}
+
+void SampleStream::Init(const int8_t *samples, const float *decoded, uint32_t loopPos, uint32_t endPos, bool loopEnabled)
+{
+    this->samples = samples;
+    this->decoded = decoded;
+    this->loopPos = loopPos;
+    this->endPos = endPos;
+    // an empty loop would never advance
+    this->loopEnabled = loopEnabled && loopPos < endPos;
+    this->pos = 0;
+
+    for (uint32_t i = 0; i < SAMPLE_SEAM_SIZE; i++) {
+        // only samples of at least SAMPLE_SEAM_SIZE fill the whole front
+        int64_t src = int64_t(endPos) - SAMPLE_SEAM_SIZE + i;
+        seam[i] = src >= 0 ? samples[src] : 0;
+        // short loops repeat within the seam
+        seam[SAMPLE_SEAM_SIZE + i] = this->loopEnabled ? samples[loopPos + i % (endPos - loopPos)] : 0;
+    }
+}
+
+const int8_t *SampleStream::Read(size_t& avail) const
+{
+    if (pos + SAMPLE_SEAM_SIZE <= endPos) {
+        avail = endPos - pos;
+        return samples + pos;
+    } else if (pos < endPos) {
+        size_t offset = SAMPLE_SEAM_SIZE - (endPos - pos);
+        avail = SAMPLE_SEAM_SIZE * 2 - offset;
+        return seam + offset;
+    } else {
+        // past the end of a sample without loop, the back of the seam is silence
+        avail = SAMPLE_SEAM_SIZE;
+        return seam + SAMPLE_SEAM_SIZE;
+    }
+}
+
+const float *SampleStream::ReadDecoded(size_t history, size_t& avail) const
+{
+    assert(decoded && history <= DECODED_SAMPLE_PAD);
+    // before the start the padding has zeros
+    int64_t start = int64_t(pos) - int64_t(history);
+    if (start >= int64_t(endPos)) {
+        if (!loopEnabled) {
+            static const float silence[DECODED_SAMPLE_PAD * 2] = {};
+            avail = DECODED_SAMPLE_PAD * 2;
+            return silence;
+        }
+        // the padding after the end continues the loop, so the same position in the loop reads the same samples
+        start = int64_t(loopPos) + (start - int64_t(endPos)) % int64_t(endPos - loopPos);
+    }
+    avail = size_t(int64_t(endPos) + DECODED_SAMPLE_PAD - start);
+    return decoded + start;
+}
+
+void SampleStream::Advance(size_t n)
+{
+    pos += uint32_t(n);
+    if (!loopEnabled)
+        return;
+    // decoded reads look back, they only wrap once all of their history is in the loop
+    uint32_t wrapPos = decoded ? endPos + DECODED_SAMPLE_PAD : endPos;
+    if (pos >= wrapPos)
+        pos = wrapPos - (endPos - loopPos) + (pos - wrapPos) % (endPos - loopPos);
+}
+
+bool SampleStream::Covers(size_t n) const
+{
+    return loopEnabled || pos + n < endPos;
+}
+
+uint32_t SampleStream::GetPos() const
+{
+    return pos;
+}
+
 Resampler::~Resampler()
 {
 }
 
-bool Resampler::ResamplerChainSampleFetchCB(std::vector<float>& fetchBuffer, size_t samplesRequired, void *cbdata)
+bool Resampler::ResamplerChainSampleFetchCB(FetchBuffer& fetchBuffer, size_t samplesRequired, void *cbdata)
 {
-    if (fetchBuffer.size() >= samplesRequired)
+    if (fetchBuffer.Size() >= samplesRequired)
         return true;
     ResamplerChainData *chainData = static_cast<ResamplerChainData *>(cbdata);
-    size_t samplesToFetch = samplesRequired - fetchBuffer.size();
-    size_t i = fetchBuffer.size();
-    fetchBuffer.resize(samplesRequired);
+    size_t samplesToFetch = samplesRequired - fetchBuffer.Size();
 
-    return chainData->_this->Process(&fetchBuffer[i], samplesToFetch,
+    return chainData->_this->Process(fetchBuffer.Append(samplesToFetch), samplesToFetch,
             chainData->phaseInc, chainData->cbPtr, chainData->cbdata);
 }
 
+bool Resampler::Skip(size_t numBlocks, float phaseInc, res_data_fetch_cb cbPtr, void *cbdata)
+{
+    if (numBlocks == 0)
+        return true;
+
+    // fetch exactly the same amount of samples as Process would so the source stays in sync
+    size_t samplesRequired = static_cast<size_t>(
+            phase + phaseInc * static_cast<float>(numBlocks));
+    samplesRequired += 1;
+    samplesRequired += fetchLookahead();
+    bool result = cbPtr(fetchBuffer, samplesRequired, cbdata);
+
+    int i = 0;
+    do {
+        phase += phaseInc;
+        int istep = static_cast<int>(phase);
+        phase -= static_cast<float>(istep);
+        i += istep;
+    } while (--numBlocks > 0);
+
+    fetchBuffer.Consume(size_t(i));
+
+    return result;
+}
+
+bool Resampler::ReadsDecoded() const
+{
+    return false;
+}
+
+bool Resampler::skipInPlace(size_t numBlocks, float phaseInc, SampleStream& stream, size_t history)
+{
+    if (numBlocks == 0)
+        return true;
+
+    size_t samplesRequired = static_cast<size_t>(
+            phase + phaseInc * static_cast<float>(numBlocks));
+    samplesRequired += 1;
+    samplesRequired += fetchLookahead();
+    bool result = stream.Covers(samplesRequired - history);
+
+    size_t i = 0;
+    do {
+        phase += phaseInc;
+        int istep = static_cast<int>(phase);
+        phase -= static_cast<float>(istep);
+        i += size_t(istep);
+    } while (--numBlocks > 0);
+
+    stream.Advance(i);
+    return result;
+}
+
 NearestResampler::NearestResampler()
 {
     Reset();
@@ -32,10 +212,20 @@ NearestResampler::~NearestResampler()
 
 void NearestResampler::Reset()
 {
-    fetchBuffer.clear();
+    fetchBuffer.Clear();
     phase = 0.0f;
 }
 
+std::unique_ptr<Resampler> NearestResampler::Clone() const
+{
+    return std::make_unique<NearestResampler>(*this);
+}
+
+size_t NearestResampler::fetchLookahead() const
+{
+    return 0;
+}
+
 bool NearestResampler::Process(float *outData, size_t numBlocks, float phaseInc, res_data_fetch_cb cbPtr, void *cbdata)
 {
     if (numBlocks == 0)
@@ -45,10 +235,11 @@ bool NearestResampler::Process(float *outData, size_t numBlocks, float phaseInc,
     // be sure and fetch one more sample in case of odd rounding errors
     samplesRequired += 1;
     bool result = cbPtr(fetchBuffer, samplesRequired, cbdata);
+    const float *in = fetchBuffer.Data();
 
     int i = 0;
     do {
-        float sample = fetchBuffer[i];
+        float sample = in[i];
         phase += phaseInc;
         int istep = static_cast<int>(phase);
         phase -= static_cast<float>(istep);
@@ -57,12 +248,46 @@ bool NearestResampler::Process(float *outData, size_t numBlocks, float phaseInc,
         *outData++ = sample;
     } while (--numBlocks > 0);
 
-    // remove first i elements from the fetch buffer since they are no longer needed
-    fetchBuffer.erase(fetchBuffer.begin(), fetchBuffer.begin() + i);
+    // the first i samples are no longer needed
+    fetchBuffer.Consume(size_t(i));
 
     return result;
 }
 
+bool NearestResampler::ProcessSample(float *outData, size_t numBlocks, float phaseInc, SampleStream& stream)
+{
+    if (numBlocks == 0)
+        return true;
+
+    // the same amount of samples as Process fetches, so the end of the sample is reached in the same call
+    size_t samplesRequired = size_t(phase + phaseInc * static_cast<float>(numBlocks));
+    samplesRequired += 1;
+    bool result = stream.Covers(samplesRequired);
+
+    do {
+        size_t avail;
+        const int8_t *in = stream.Read(avail);
+        size_t i = 0;
+        do {
+            float sample = float(in[i]) * PCM_SAMPLE_SCALE;
+            phase += phaseInc;
+            int istep = static_cast<int>(phase);
+            phase -= static_cast<float>(istep);
+            i += size_t(istep);
+
+            *outData++ = sample;
+        } while (--numBlocks > 0 && i < avail);
+        stream.Advance(i);
+    } while (numBlocks > 0);
+
+    return result;
+}
+
+bool NearestResampler::SkipSample(size_t numBlocks, float phaseInc, SampleStream& stream)
+{
+    return skipInPlace(numBlocks, phaseInc, stream, 0);
+}
+
 LinearResampler::LinearResampler()
 {
     Reset();
@@ -74,10 +299,20 @@ LinearResampler::~LinearResampler()
 
 void LinearResampler::Reset()
 {
-    fetchBuffer.clear();
+    fetchBuffer.Clear();
     phase = 0.0f;
 }
 
+std::unique_ptr<Resampler> LinearResampler::Clone() const
+{
+    return std::make_unique<LinearResampler>(*this);
+}
+
+size_t LinearResampler::fetchLookahead() const
+{
+    return 1;
+}
+
 bool LinearResampler::Process(float *outData, size_t numBlocks, float phaseInc, res_data_fetch_cb cbPtr, void *cbdata)
 {
     if (numBlocks == 0)
@@ -90,11 +325,12 @@ bool LinearResampler::Process(float *outData, size_t numBlocks, float phaseInc,
     // fetch one more for linear interpolation
     samplesRequired += 1;
     bool result = cbPtr(fetchBuffer, samplesRequired, cbdata);
+    const float *in = fetchBuffer.Data();
 
     int i = 0;
     do {
-        float a = fetchBuffer[i];
-        float b = fetchBuffer[i+1];
+        float a = in[i];
+        float b = in[i+1];
         float sample = a + phase * (b - a);
         phase += phaseInc;
         int istep = static_cast<int>(phase);
@@ -104,12 +340,50 @@ bool LinearResampler::Process(float *outData, size_t numBlocks, float phaseInc,
         *outData++ = sample;
     } while (--numBlocks > 0);
 
-    // remove first i elements from the fetch buffer since they are no longer needed
-    fetchBuffer.erase(fetchBuffer.begin(), fetchBuffer.begin() + i);
+    // the first i samples are no longer needed
+    fetchBuffer.Consume(size_t(i));
+
+    return result;
+}
+
+bool LinearResampler::ProcessSample(float *outData, size_t numBlocks, float phaseInc, SampleStream& stream)
+{
+    if (numBlocks == 0)
+        return true;
+
+    // the same amount of samples as Process fetches, so the end of the sample is reached in the same call
+    size_t samplesRequired = static_cast<size_t>(
+            phase + phaseInc * static_cast<float>(numBlocks));
+    samplesRequired += 2;
+    bool result = stream.Covers(samplesRequired);
+
+    do {
+        size_t avail;
+        const int8_t *in = stream.Read(avail);
+        size_t i = 0;
+        do {
+            float a = float(in[i]);
+            float b = float(in[i+1]);
+            // scaling by a power of two afterwards gives exactly the same result
+            float sample = (a + phase * (b - a)) * PCM_SAMPLE_SCALE;
+            phase += phaseInc;
+            int istep = static_cast<int>(phase);
+            phase -= static_cast<float>(istep);
+            i += size_t(istep);
+
+            *outData++ = sample;
+        } while (--numBlocks > 0 && i + 1 < avail);
+        stream.Advance(i);
+    } while (numBlocks > 0);
 
     return result;
 }
 
+bool LinearResampler::SkipSample(size_t numBlocks, float phaseInc, SampleStream& stream)
+{
+    return skipInPlace(numBlocks, phaseInc, stream, 0);
+}
+
 //static float triangle(float t)
 //{
 //    if (t < -1.0f)
@@ -124,9 +398,59 @@ bool LinearResampler::Process(float *outData, size_t numBlocks, float phaseInc,
 
 #define SINC_WINDOW_SIZE 16
 #define SINC_FILT_THRESH 0.8f
+#define SINC_TAPS (SINC_WINDOW_SIZE * 2)
+// kernels are made for SINC_PHASES + 1 phases from one sample to the next, in between they are interpolated
+#define SINC_PHASES 64
+
+// window of each tap for all phases
+static std::vector<double> sinc_window = []() {
+    std::vector<double> w((SINC_PHASES + 1) * SINC_TAPS);
+    for (size_t p = 0; p <= SINC_PHASES; p++) {
+        for (size_t i = 0; i < SINC_TAPS; i++) {
+            double t = double(int(i) - SINC_WINDOW_SIZE + 1) - double(p) / double(SINC_PHASES);
+            w[p * SINC_TAPS + i] = 0.5 + 0.5 * cos(M_PI * t / double(SINC_WINDOW_SIZE));
+        }
+    }
+    return w;
+}();
+
+// fills kernels with the normalized windowed sinc kernels of all phases for one cutoff
+static void make_sinc_kernels(float *kernels, double sincStep)
+{
+    double dx = M_PI * sincStep;
+    double ds = sin(dx);
+    double dc = cos(dx);
+    for (size_t p = 0; p <= SINC_PHASES; p++) {
+        double phase = double(p) / double(SINC_PHASES);
+        // the sinc argument goes up by dx from tap to tap, so its sine can be rotated along
+        double s = sin(dx * (double(-SINC_WINDOW_SIZE + 1) - phase));
+        double c = cos(dx * (double(-SINC_WINDOW_SIZE + 1) - phase));
+        const double *window = &sinc_window[p * SINC_TAPS];
+        double kernel[SINC_TAPS];
+        double kernelSum = 0.0;
+        for (size_t i = 0; i < SINC_TAPS; i++) {
+            double x = dx * (double(int(i) - SINC_WINDOW_SIZE + 1) - phase);
+            kernel[i] = (x == 0.0 ? 1.0 : s / x) * window[i];
+            kernelSum += kernel[i];
+            double next = s * dc + c * ds;
+            c = c * dc - s * ds;
+            s = next;
+        }
+        for (size_t i = 0; i < SINC_TAPS; i++)
+            kernels[p * SINC_TAPS + i] = static_cast<float>(kernel[i] / kernelSum);
+    }
+}
+
+// kernels of all phases without a lowpass, used whenever the input isn't decimated
+static std::vector<float> sinc_bank = []() {
+    std::vector<float> bank((SINC_PHASES + 1) * SINC_TAPS);
+    make_sinc_kernels(bank.data(), 1.0);
+    return bank;
+}();
 
 SincResampler::SincResampler()
 {
+    cutoffPhaseInc = 0.0f;
     Reset();
 }
 
@@ -136,11 +460,22 @@ SincResampler::~SincResampler()
 
 void SincResampler::Reset()
 {
-    fetchBuffer.clear();
-    fetchBuffer.resize(SINC_WINDOW_SIZE, 0.0f);
+    fetchBuffer.Clear();
+    float *history = fetchBuffer.Append(SINC_WINDOW_SIZE);
+    std::fill(history, history + SINC_WINDOW_SIZE, 0.0f);
     phase = 0.0f;
 }
 
+std::unique_ptr<Resampler> SincResampler::Clone() const
+{
+    return std::make_unique<SincResampler>(*this);
+}
+
+size_t SincResampler::fetchLookahead() const
+{
+    return SINC_WINDOW_SIZE * 2;
+}
+
 bool SincResampler::Process(float *outData, size_t numBlocks, float phaseInc, res_data_fetch_cb cbPtr, void *cbdata)
 {
     if (numBlocks == 0)
@@ -154,122 +489,181 @@ bool SincResampler::Process(float *outData, size_t numBlocks, float phaseInc, re
     samplesRequired += SINC_WINDOW_SIZE * 2;
     bool result = cbPtr(fetchBuffer, samplesRequired, cbdata);
 
-    float sincStep = phaseInc > SINC_FILT_THRESH ? SINC_FILT_THRESH / phaseInc : 1.00f;
-    //float sincStep = 1.0;
+    size_t i = resample(outData, numBlocks, phaseInc, fetchBuffer.Data(), fetchBuffer.Size());
+    assert(numBlocks == 0);
+    // the first i samples are no longer needed
+    fetchBuffer.Consume(i);
 
-    //_print_debug("phaseInc=%f sincStep=%f", phaseInc, sincStep);
+    return result;
+}
+
+bool SincResampler::ProcessSample(float *outData, size_t numBlocks, float phaseInc, SampleStream& stream)
+{
+    if (numBlocks == 0)
+        return true;
+
+    // the same amount of samples as Process fetches, the window starts SINC_WINDOW_SIZE samples
+    // before the stream position like the fetch buffer after Reset
+    size_t samplesRequired = static_cast<size_t>(
+            phase + phaseInc * static_cast<float>(numBlocks));
+    samplesRequired += 1 + SINC_WINDOW_SIZE * 2;
+    bool result = stream.Covers(samplesRequired - SINC_WINDOW_SIZE);
 
-    int i = 0;
     do {
-        float sampleSum = 0.0f;
-        float kernelSum = 0.0f;
-        for (int wi = -SINC_WINDOW_SIZE + 1; wi <= SINC_WINDOW_SIZE; wi++) {
-            float sincIndex = (float(wi) - phase) * sincStep;
-            float windowIndex = float(wi) - phase;
-            //_print_debug("wi=%zu phase=%f sincStep=%f sincIndex=%f", wi, phase, sincStep, sincIndex);
-            float s = fast_sincf(sincIndex);
-            float w = window_func(windowIndex);
-            //float s = triangle(sincIndex);
-            //float w = 1.0f;
-            float kernel = s * w;
-            sampleSum += kernel * fetchBuffer[i + wi + SINC_WINDOW_SIZE - 1];
-            kernelSum += kernel;
-            //_print_debug("s=%f w=%f fetchBuffer[i + wi]=%f", s, w, fetchBuffer[i + wi]);
-        }
-        //_print_debug("sum=%f", sum);
+        size_t avail;
+        const float *in = stream.ReadDecoded(SINC_WINDOW_SIZE, avail);
+        stream.Advance(resample(outData, numBlocks, phaseInc, in, avail));
+    } while (numBlocks > 0);
+
+    return result;
+}
+
+bool SincResampler::SkipSample(size_t numBlocks, float phaseInc, SampleStream& stream)
+{
+    return skipInPlace(numBlocks, phaseInc, stream, SINC_WINDOW_SIZE);
+}
+
+bool SincResampler::ReadsDecoded() const
+{
+    return true;
+}
+
+size_t SincResampler::resample(float *&outData, size_t& numBlocks, float phaseInc, const float *in, size_t avail)
+{
+    const float *kernels = getKernels(phaseInc);
+
+    size_t i = 0;
+    do {
+        assert(phase >= 0.0f && phase < 1.0f);
+        float phasePos = phase * float(SINC_PHASES);
+        int p = static_cast<int>(phasePos);
+        const float *kernel = kernels + p * SINC_TAPS;
+        *outData++ = agbplay::MixKernels::InterpolatedFir(in + i, kernel, kernel + SINC_TAPS,
+                phasePos - static_cast<float>(p), SINC_TAPS);
+
         phase += phaseInc;
         int istep = static_cast<int>(phase);
         phase -= static_cast<float>(istep);
-        i += istep;
+        i += size_t(istep);
+    } while (--numBlocks > 0 && i + SINC_TAPS <= avail);
+    return i;
+}
 
-        *outData++ = sampleSum / kernelSum;
-        //*outData++ = sampleSum;
-        //_print_debug("kernel sum: %f\n", kernelSum);
-    } while (--numBlocks > 0);
-    // remove first i elements from the fetch buffer since they are no longer needed
-    fetchBuffer.erase(fetchBuffer.begin(), fetchBuffer.begin() + i);
+size_t SincResampler::ProcessRatio(float *outData, size_t numBlocks, const float *in, size_t& phaseNum, size_t inStep, size_t outStep)
+{
+    const float *kernels = getKernels(float(double(inStep) / double(outStep)));
+    float outStepReciprocal = 1.0f / float(outStep);
+
+    size_t i = 0;
+    for (size_t n = 0; n < numBlocks; n++) {
+        assert(phaseNum < outStep);
+        size_t phasePos = phaseNum * SINC_PHASES;
+        size_t p = phasePos / outStep;
+        const float *kernel = kernels + p * SINC_TAPS;
+        *outData++ = agbplay::MixKernels::InterpolatedFir(in + i, kernel, kernel + SINC_TAPS,
+                float(phasePos - p * outStep) * outStepReciprocal, SINC_TAPS);
+
+        phaseNum += inStep;
+        i += phaseNum / outStep;
+        phaseNum %= outStep;
+    }
+    return i;
+}
 
-    return result;
+size_t SincResampler::WindowTaps()
+{
+    return SINC_TAPS;
+}
+
+size_t SincResampler::WindowCenter()
+{
+    return SINC_WINDOW_SIZE - 1;
+}
+
+const float *SincResampler::getKernels(float phaseInc)
+{
+    if (phaseInc <= SINC_FILT_THRESH)
+        return sinc_bank.data();
+    // the cutoff (sincStep) only depends on the pitch, which rarely changes, so the kernels are kept until it does
+    if (phaseInc != cutoffPhaseInc) {
+        cutoffKernels.resize((SINC_PHASES + 1) * SINC_TAPS);
+        make_sinc_kernels(cutoffKernels.data(), double(SINC_FILT_THRESH / phaseInc));
+        cutoffPhaseInc = phaseInc;
+    }
+    return cutoffKernels.data();
 }
 
 /*
- * fast trigonometric functions
+ * fast sine integral
  */
 
 #define LUT_SIZE 1024
 
-static std::vector<float> cos_lut = []() {
-    std::vector<float> l(LUT_SIZE);
-    for (size_t i = 0; i < l.size(); i++) {
-        float index = float(i) * float(2.0 * M_PI / double(LUT_SIZE));
-        l[i] = cosf(index);
-    }
-    return l;
-}();
+#define INTEGRAL_RESOLUTION 256
 
-static std::vector<float> sinc_lut = []() {
+static std::vector<float> Si_lut = []() {
     std::vector<float> l(LUT_SIZE+2);
-    for (size_t i = 0; i < LUT_SIZE+1; i++) {
-        float index = float(i) * float(SINC_WINDOW_SIZE * M_PI / double(LUT_SIZE));
-        l[i] = boost::math::sinc_pi(index);
-    }
-    l[LUT_SIZE+1] = 0.0f;
-    return l;
-}();
+    double acc = 0.0;
+    double step_per_index = double(SINC_WINDOW_SIZE) / double(LUT_SIZE);
+    double integration_inc = step_per_index / double(INTEGRAL_RESOLUTION);
+    double index = 0.0;
+    double prev_value = 1.0;
 
-static std::vector<float> win_lut = []() {
-    std::vector<float> l(LUT_SIZE+2);
     for (size_t i = 0; i < LUT_SIZE+1; i++) {
-        float index = float(i) * float(M_PI / double(LUT_SIZE));
-        l[i] = 0.5f + (0.5f * cosf(index));
+        double convergence_level = 0.5 - 0.5 * cos(double(i) * M_PI / double(LUT_SIZE));
+        double integral_level = 1.0 - convergence_level;
+        l[i] = static_cast<float>(acc * integral_level + 0.5 * convergence_level);
+        for (size_t j = 0; j < INTEGRAL_RESOLUTION; j++) {
+            index += integration_inc;
+            double new_value = boost::math::sinc_pi(M_PI * index);
+            acc += (new_value + prev_value) * integration_inc * 0.5;
+            prev_value = new_value;
+        }
     }
-    l[LUT_SIZE+1] = 0.0f;
+    l[LUT_SIZE+1] = 0.5f;
     return l;
 }();
 
-float SincResampler::fast_sinf(float t)
-{
-    return SincResampler::fast_cosf(t - float(M_PI / 2.0));
-}
-
-float SincResampler::fast_cosf(float t)
-{
-    t = fabs(t);
-    t *= float(double(LUT_SIZE) / (2.0 * M_PI));
-    unsigned int left_index = static_cast<unsigned int>(t);
-    float fraction = t - static_cast<float>(left_index);
-    unsigned int right_index = (left_index + 1) % LUT_SIZE;
-    left_index %= LUT_SIZE;
-    return cos_lut[left_index] + fraction * (cos_lut[right_index] - cos_lut[left_index]);
-}
-
-float SincResampler::fast_sincf(float t)
+float BlepResampler::fast_Si(float t)
 {
+    float signed_t = t;
     t = fabs(t);
-    assert(t <= SINC_WINDOW_SIZE);
+    t = std::min(t, float(SINC_WINDOW_SIZE));
     t *= float(double(LUT_SIZE) / double(SINC_WINDOW_SIZE));
     unsigned int left_index = static_cast<unsigned int>(t);
     float fraction = t - static_cast<float>(left_index);
     unsigned int right_index = left_index + 1;
-    return sinc_lut[left_index] + fraction * (sinc_lut[right_index] - sinc_lut[left_index]);
+    float retval = Si_lut[left_index] + fraction * (Si_lut[right_index] - Si_lut[left_index]);
+    return copysignf(retval, signed_t);
 }
 
-float SincResampler::window_func(float t)
+// Si_lut mirrored to negative arguments, so no sign handling is needed
+static std::vector<float> Si_sym_lut = []() {
+    std::vector<float> l(LUT_SIZE * 2 + 2);
+    for (size_t i = 0; i <= LUT_SIZE; i++) {
+        l[LUT_SIZE + i] = Si_lut[i];
+        l[LUT_SIZE - i] = -Si_lut[i];
+    }
+    l[LUT_SIZE * 2 + 1] = 0.5f;
+    return l;
+}();
+
+// same as fast_Si, but with fewer operations
+static inline float fast_Si_sym(float t)
 {
-    assert(t >= -float(SINC_WINDOW_SIZE));
-    assert(t <= +float(SINC_WINDOW_SIZE));
-    //return 0.42659f - 0.49656f * cosf(2.0f * PI_F * t / float(SINC_WINDOW_SIZE - 1)) +
-    //    0.076849f * cosf(4.0f * PI_F * t / float(SINC_WINDOW_SIZE - 1));
-    t = fabs(t);
-    t *= float(double(LUT_SIZE) / double(SINC_WINDOW_SIZE));
+    t = std::min(std::max(t, -float(SINC_WINDOW_SIZE)), float(SINC_WINDOW_SIZE));
+    t = (t + float(SINC_WINDOW_SIZE)) * float(LUT_SIZE / SINC_WINDOW_SIZE);
     unsigned int left_index = static_cast<unsigned int>(t);
     float fraction = t - static_cast<float>(left_index);
-    unsigned int right_index = left_index + 1;
-    return win_lut[left_index] + fraction * (win_lut[right_index] - win_lut[left_index]);
+    return Si_sym_lut[left_index] + fraction * (Si_sym_lut[left_index + 1] - Si_sym_lut[left_index]);
 }
 
+// from this phaseInc on the kernels are smooth enough to be interpolated between SINC_PHASES + 1 phases
+#define BLEP_TABLE_MIN_INC 0.4f
+
 BlepResampler::BlepResampler()
 {
+    cutoffPhaseInc = 0.0f;
     Reset();
 }
 
@@ -279,11 +673,22 @@ BlepResampler::~BlepResampler()
 
 void BlepResampler::Reset()
 {
-    fetchBuffer.clear();
-    fetchBuffer.resize(SINC_WINDOW_SIZE, 0.0f);
+    fetchBuffer.Clear();
+    float *history = fetchBuffer.Append(SINC_WINDOW_SIZE);
+    std::fill(history, history + SINC_WINDOW_SIZE, 0.0f);
     phase = 0.0f;
 }
 
+std::unique_ptr<Resampler> BlepResampler::Clone() const
+{
+    return std::make_unique<BlepResampler>(*this);
+}
+
+size_t BlepResampler::fetchLookahead() const
+{
+    return SINC_WINDOW_SIZE * 2;
+}
+
 bool BlepResampler::Process(float *outData, size_t numBlocks, float phaseInc, res_data_fetch_cb cbPtr, void *cbdata)
 {
     if (numBlocks == 0)
@@ -297,70 +702,112 @@ bool BlepResampler::Process(float *outData, size_t numBlocks, float phaseInc, re
     samplesRequired += SINC_WINDOW_SIZE * 2;
     bool result = cbPtr(fetchBuffer, samplesRequired, cbdata);
 
-    float sincStep = SINC_FILT_THRESH / phaseInc;
+    size_t i = resample(outData, numBlocks, phaseInc, fetchBuffer.Data(), fetchBuffer.Size());
+    assert(numBlocks == 0);
+    // the first i samples are no longer needed
+    fetchBuffer.Consume(i);
 
-    int i = 0;
-    do {
-        float sampleSum = 0.0f;
-        float kernelSum = 0.0f;
-        for (int wi = -SINC_WINDOW_SIZE + 1; wi <= SINC_WINDOW_SIZE; wi++) {
-            float SiIndexLeft = (float(wi) - phase - 0.5f) * sincStep;
-            float SiIndexRight = (float(wi) - phase + 0.5f) * sincStep;
-            float sl = fast_Si(SiIndexLeft);
-            float sr = fast_Si(SiIndexRight);
-            float kernel = sr - sl;
-            sampleSum += kernel * fetchBuffer[i + wi + SINC_WINDOW_SIZE - 1];
-            kernelSum += kernel;
-        }
-        phase += phaseInc;
-        int istep = static_cast<int>(phase);
-        phase -= static_cast<float>(istep);
-        i += istep;
+    return result;
+}
 
-        *outData++ = sampleSum / kernelSum;
-        //*outData++ = sampleSum;
-        //_print_debug("kernel sum: %f\n", kernelSum);
-    } while (--numBlocks > 0);
-    // remove first i elements from the fetch buffer since they are no longer needed
-    fetchBuffer.erase(fetchBuffer.begin(), fetchBuffer.begin() + i);
+bool BlepResampler::ProcessSample(float *outData, size_t numBlocks, float phaseInc, SampleStream& stream)
+{
+    if (numBlocks == 0)
+        return true;
+
+    // see SincResampler::ProcessSample
+    size_t samplesRequired = static_cast<size_t>(
+            phase + phaseInc * static_cast<float>(numBlocks));
+    samplesRequired += 1 + SINC_WINDOW_SIZE * 2;
+    bool result = stream.Covers(samplesRequired - SINC_WINDOW_SIZE);
+
+    do {
+        size_t avail;
+        const float *in = stream.ReadDecoded(SINC_WINDOW_SIZE, avail);
+        stream.Advance(resample(outData, numBlocks, phaseInc, in, avail));
+    } while (numBlocks > 0);
 
     return result;
 }
 
-#define INTEGRAL_RESOLUTION 256
+bool BlepResampler::SkipSample(size_t numBlocks, float phaseInc, SampleStream& stream)
+{
+    return skipInPlace(numBlocks, phaseInc, stream, SINC_WINDOW_SIZE);
+}
 
-static std::vector<float> Si_lut = []() {
-    std::vector<float> l(LUT_SIZE+2);
-    double acc = 0.0;
-    double step_per_index = double(SINC_WINDOW_SIZE) / double(LUT_SIZE);
-    double integration_inc = step_per_index / double(INTEGRAL_RESOLUTION);
-    double index = 0.0;
-    double prev_value = 1.0;
+bool BlepResampler::ReadsDecoded() const
+{
+    return true;
+}
 
-    for (size_t i = 0; i < LUT_SIZE+1; i++) {
-        double convergence_level = 0.5 - 0.5 * cos(double(i) * M_PI / double(LUT_SIZE));
-        double integral_level = 1.0 - convergence_level;
-        l[i] = static_cast<float>(acc * integral_level + 0.5 * convergence_level);
-        for (size_t j = 0; j < INTEGRAL_RESOLUTION; j++) {
-            index += integration_inc;
-            double new_value = boost::math::sinc_pi(M_PI * index);
-            acc += (new_value + prev_value) * integration_inc * 0.5;
-            prev_value = new_value;
-        }
+size_t BlepResampler::resample(float *&outData, size_t& numBlocks, float phaseInc, const float *in, size_t avail)
+{
+    size_t i = 0;
+    if (phaseInc >= BLEP_TABLE_MIN_INC) {
+        const float *kernels = getKernels(phaseInc);
+        do {
+            assert(phase >= 0.0f && phase < 1.0f);
+            float phasePos = phase * float(SINC_PHASES);
+            int p = static_cast<int>(phasePos);
+            const float *kernel = kernels + p * SINC_TAPS;
+            *outData++ = agbplay::MixKernels::InterpolatedFir(in + i, kernel, kernel + SINC_TAPS,
+                    phasePos - static_cast<float>(p), SINC_TAPS);
+
+            phase += phaseInc;
+            int istep = static_cast<int>(phase);
+            phase -= static_cast<float>(istep);
+            i += size_t(istep);
+        } while (--numBlocks > 0 && i + SINC_TAPS <= avail);
+    } else {
+        /*
+         * The integrated kernel is constant further than reach away from the current position,
+         * so only the few taps in between contribute. The outer edges are always further away,
+         * which makes the kernel sum 1.
+         */
+        float sincStep = SINC_FILT_THRESH / phaseInc;
+        float reach = float(SINC_WINDOW_SIZE) / sincStep;
+        do {
+            int first = static_cast<int>(floorf(phase - 0.5f - reach)) + 1;
+            int last = static_cast<int>(ceilf(phase + 0.5f + reach)) - 1;
+            assert(first > -SINC_WINDOW_SIZE + 1 && last < SINC_WINDOW_SIZE);
+            float sampleSum = 0.0f;
+            float sl = fast_Si_sym((float(first) - phase - 0.5f) * sincStep);
+            for (int wi = first; wi <= last; wi++) {
+                float sr = fast_Si_sym((float(wi) - phase + 0.5f) * sincStep);
+                sampleSum += (sr - sl) * in[int(i) + wi + SINC_WINDOW_SIZE - 1];
+                sl = sr;
+            }
+            phase += phaseInc;
+            int istep = static_cast<int>(phase);
+            phase -= static_cast<float>(istep);
+            i += size_t(istep);
+
+            *outData++ = sampleSum;
+        } while (--numBlocks > 0 && i + SINC_TAPS <= avail);
     }
-    l[LUT_SIZE+1] = 0.5f;
-    return l;
-}();
+    return i;
+}
 
-float BlepResampler::fast_Si(float t)
+const float *BlepResampler::getKernels(float phaseInc)
 {
-    float signed_t = t;
-    t = fabs(t);
-    t = std::min(t, float(SINC_WINDOW_SIZE));
-    t *= float(double(LUT_SIZE) / double(SINC_WINDOW_SIZE));
-    unsigned int left_index = static_cast<unsigned int>(t);
-    float fraction = t - static_cast<float>(left_index);
-    unsigned int right_index = left_index + 1;
-    float retval = Si_lut[left_index] + fraction * (Si_lut[right_index] - Si_lut[left_index]);
-    return copysignf(retval, signed_t);
+    // like with SincResampler the kernels are only calculated again if the pitch changes
+    if (phaseInc != cutoffPhaseInc) {
+        float sincStep = SINC_FILT_THRESH / phaseInc;
+        cutoffKernels.resize((SINC_PHASES + 1) * SINC_TAPS);
+        for (size_t p = 0; p <= SINC_PHASES; p++) {
+            float kernelPhase = float(p) / float(SINC_PHASES);
+            float *kernel = &cutoffKernels[p * SINC_TAPS];
+            double kernelSum = 0.0;
+            for (int wi = -SINC_WINDOW_SIZE + 1; wi <= SINC_WINDOW_SIZE; wi++) {
+                float sl = fast_Si((float(wi) - kernelPhase - 0.5f) * sincStep);
+                float sr = fast_Si((float(wi) - kernelPhase + 0.5f) * sincStep);
+                kernel[wi + SINC_WINDOW_SIZE - 1] = sr - sl;
+                kernelSum += double(sr - sl);
+            }
+            for (size_t t = 0; t < SINC_TAPS; t++)
+                kernel[t] = static_cast<float>(double(kernel[t]) / kernelSum);
+        }
+        cutoffPhaseInc = phaseInc;
+    }
+    return cutoffKernels.data();
 }
@@ -1,6 +1,38 @@
 #pragma once
 
 #include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+// int8 PCM samples are scaled to [-1, 1)
+#define PCM_SAMPLE_SCALE (1.0f / 128.0f)
+// samples before and after the end of a sample in the seam of SampleStream
+#define SAMPLE_SEAM_SIZE 16
+// decoded samples are preceded by this many zeros and followed by as many samples of the loop or zeros
+#define DECODED_SAMPLE_PAD 32
+
+/*
+ * FetchBuffer holds the source samples a resampler has fetched but not used up yet.
+ * Consumed samples are only skipped. The remaining ones are moved to the front of
+ * the storage once an Append doesn't fit anymore, which happens every few calls and
+ * only moves the few samples the resampler still looks at.
+ */
+class FetchBuffer {
+public:
+    FetchBuffer();
+    size_t Size() const;
+    float *Data();
+    // makes room for n samples after the current ones, the caller has to write all of them
+    float *Append(size_t n);
+    // drops the first n samples
+    void Consume(size_t n);
+    void Clear();
+private:
+    std::vector<float> samples;
+    size_t start;
+    size_t end;
+};
 
 /* 
  * res_data_fetch_cb fetches samplesRequired samples to fetchBuffer
@@ -8,15 +40,52 @@
  *
  * returns false in case of 'end of stream'
  */
-typedef bool (*res_data_fetch_cb)(std::vector<float>& fetchBuffer, size_t samplesRequired, void *cbdata);
+typedef bool (*res_data_fetch_cb)(FetchBuffer& fetchBuffer, size_t samplesRequired, void *cbdata);
+
+/*
+ * SampleStream reads an int8 PCM sample in place. Reads close to the end go through
+ * a seam that holds the last samples before the end and the ones that follow them,
+ * which are the start of the loop or silence, so every read is contiguous.
+ * Filtering resamplers read the decoded float samples instead, see SampleCache.
+ */
+class SampleStream {
+public:
+    SampleStream();
+    // starts at the beginning of the sample, the seam is built here once per note, decoded may be null
+    void Init(const int8_t *samples, const float *decoded, uint32_t loopPos, uint32_t endPos, bool loopEnabled);
+    // returns the samples from the current position on, avail is set to how many of them are contiguous
+    const int8_t *Read(size_t& avail) const;
+    // like Read, but starts history (up to DECODED_SAMPLE_PAD) samples before the current position
+    const float *ReadDecoded(size_t history, size_t& avail) const;
+    void Advance(size_t n);
+    // like the return value of res_data_fetch_cb: false if n samples from the current position reach the end
+    bool Covers(size_t n) const;
+    uint32_t GetPos() const;
+private:
+    const int8_t *samples;
+    const float *decoded;
+    uint32_t loopPos;
+    uint32_t endPos;
+    bool loopEnabled;
+    uint32_t pos;
+    int8_t seam[SAMPLE_SEAM_SIZE * 2];
+};
 
 class Resampler {
 public:
     // return value false by Process signals the "end of stream"
     virtual bool Process(float *outData, size_t numBlocks, float phaseInc, res_data_fetch_cb cbPtr, void *cbdata) = 0;
+    // advances the resampler state exactly like Process does, but without producing any output
+    bool Skip(size_t numBlocks, float phaseInc, res_data_fetch_cb cbPtr, void *cbdata);
+    // resamples a PCM sample in place
+    virtual bool ProcessSample(float *outData, size_t numBlocks, float phaseInc, SampleStream& stream) = 0;
+    virtual bool SkipSample(size_t numBlocks, float phaseInc, SampleStream& stream) = 0;
+    // ProcessSample reads the decoded samples, the stream has to be initialized with them
+    virtual bool ReadsDecoded() const;
     virtual void Reset() = 0;
+    virtual std::unique_ptr<Resampler> Clone() const = 0;
     virtual ~Resampler();
-    static bool ResamplerChainSampleFetchCB(std::vector<float>& fetchBuffer, size_t samplesRequired, void *cbdata);
+    static bool ResamplerChainSampleFetchCB(FetchBuffer& fetchBuffer, size_t samplesRequired, void *cbdata);
     struct ResamplerChainData {
         // pointer to access our object
         Resampler *_this;
@@ -26,7 +95,11 @@ public:
         void *cbdata;
     };
 protected:
-    std::vector<float> fetchBuffer;
+    // number of samples Process fetches beyond the last interpolated position
+    virtual size_t fetchLookahead() const = 0;
+    // SkipSample, history is the number of samples the resampler reads before the stream position
+    bool skipInPlace(size_t numBlocks, float phaseInc, SampleStream& stream, size_t history);
+    FetchBuffer fetchBuffer;
     float phase;
 };
 
@@ -35,7 +108,13 @@ public:
     NearestResampler();
     ~NearestResampler() override;
     bool Process(float *outData, size_t numBlocks, float phaseInc, res_data_fetch_cb cbPtr, void *cbdata) override;
+    // reads in place, these only look at one or two samples per output
+    bool ProcessSample(float *outData, size_t numBlocks, float phaseInc, SampleStream& stream) override;
+    bool SkipSample(size_t numBlocks, float phaseInc, SampleStream& stream) override;
     void Reset() override;
+    std::unique_ptr<Resampler> Clone() const override;
+protected:
+    size_t fetchLookahead() const override;
 };
 
 class LinearResampler : public Resampler {
@@ -43,7 +122,13 @@ public:
     LinearResampler();
     ~LinearResampler() override;
     bool Process(float *outData, size_t numBlocks, float phaseInc, res_data_fetch_cb cbPtr, void *cbdata) override;
+    // reads in place, these only look at one or two samples per output
+    bool ProcessSample(float *outData, size_t numBlocks, float phaseInc, SampleStream& stream) override;
+    bool SkipSample(size_t numBlocks, float phaseInc, SampleStream& stream) override;
     void Reset() override;
+    std::unique_ptr<Resampler> Clone() const override;
+protected:
+    size_t fetchLookahead() const override;
 };
 
 class SincResampler : public Resampler {
@@ -51,12 +136,32 @@ public:
     SincResampler();
     ~SincResampler() override;
     bool Process(float *outData, size_t numBlocks, float phaseInc, res_data_fetch_cb cbPtr, void *cbdata) override;
+    bool ProcessSample(float *outData, size_t numBlocks, float phaseInc, SampleStream& stream) override;
+    bool SkipSample(size_t numBlocks, float phaseInc, SampleStream& stream) override;
+    bool ReadsDecoded() const override;
     void Reset() override;
+    std::unique_ptr<Resampler> Clone() const override;
+    /*
+     * Resamples by the exact ratio inStep / outStep without a fetch buffer. The window of the
+     * first output starts at in, phaseNum is its position between two input samples in units
+     * of 1 / outStep and is updated like the phase. The caller has to provide all samples the
+     * windows reach. Returns the number of input samples the window moved.
+     */
+    size_t ProcessRatio(float *outData, size_t numBlocks, const float *in, size_t& phaseNum, size_t inStep, size_t outStep);
+    // number of samples each window reads, the position of an output is the sample
+    // at WindowCenter from the window start plus the phase
+    static size_t WindowTaps();
+    static size_t WindowCenter();
+protected:
+    size_t fetchLookahead() const override;
 private:
-    static float fast_sinf(float t);
-    static float fast_cosf(float t);
-    static float fast_sincf(float t);
-    static float window_func(float t);
+    // resamples until all blocks are done or the next window doesn't fit in the avail samples at in,
+    // returns the number of samples the window moved
+    size_t resample(float *&outData, size_t& numBlocks, float phaseInc, const float *in, size_t avail);
+    const float *getKernels(float phaseInc);
+    // kernels of all phases for the cutoff of cutoffPhaseInc, see getKernels
+    std::vector<float> cutoffKernels;
+    float cutoffPhaseInc;
 };
 
 class BlepResampler : public Resampler {
@@ -64,7 +169,19 @@ public:
     BlepResampler();
     ~BlepResampler() override;
     bool Process(float *outData, size_t numBlocks, float phaseInc, res_data_fetch_cb cbPtr, void *cbdata) override;
+    bool ProcessSample(float *outData, size_t numBlocks, float phaseInc, SampleStream& stream) override;
+    bool SkipSample(size_t numBlocks, float phaseInc, SampleStream& stream) override;
+    bool ReadsDecoded() const override;
     void Reset() override;
+    std::unique_ptr<Resampler> Clone() const override;
+protected:
+    size_t fetchLookahead() const override;
 private:
     static float fast_Si(float t);
+    // see SincResampler::resample
+    size_t resample(float *&outData, size_t& numBlocks, float phaseInc, const float *in, size_t avail);
+    const float *getKernels(float phaseInc);
+    // kernels of all phases for cutoffPhaseInc, only used for phaseInc >= BLEP_TABLE_MIN_INC
+    std::vector<float> cutoffKernels;
+    float cutoffPhaseInc;
 };
@@ -26,6 +26,11 @@ ReverbEffect::~ReverbEffect()
 {
 }
 
+ReverbEffect *ReverbEffect::Clone() const
+{
+    return new ReverbEffect(*this);
+}
+
 void ReverbEffect::ProcessData(float *buffer, size_t nBlocks)
 {
     while (nBlocks > 0)
@@ -36,6 +41,11 @@ void ReverbEffect::ProcessData(float *buffer, size_t nBlocks)
     }
 }
 
+void ReverbEffect::Reset()
+{
+    fill(reverbBuffer.begin(), reverbBuffer.end(), 0.0f);
+}
+
 /*
  * protected ReverbEffect
  */
@@ -86,6 +96,17 @@ ReverbGS1::~ReverbGS1()
 {
 }
 
+ReverbEffect *ReverbGS1::Clone() const
+{
+    return new ReverbGS1(*this);
+}
+
+void ReverbGS1::Reset()
+{
+    ReverbEffect::Reset();
+    fill(gsBuffer.begin(), gsBuffer.end(), 0.0f);
+}
+
 size_t ReverbGS1::getBlocksPerGsBuffer() const
 {
     return gsBuffer.size() / N_CHANNELS;
@@ -153,6 +174,17 @@ ReverbGS2::~ReverbGS2()
 {
 }
 
+ReverbEffect *ReverbGS2::Clone() const
+{
+    return new ReverbGS2(*this);
+}
+
+void ReverbGS2::Reset()
+{
+    ReverbEffect::Reset();
+    fill(gs2Buffer.begin(), gs2Buffer.end(), 0.0f);
+}
+
 size_t ReverbGS2::processInternal(float *buffer, size_t nBlocks)
 {
     assert(nBlocks > 0);
@@ -218,6 +250,11 @@ ReverbTest::~ReverbTest()
 {
 }
 
+ReverbEffect *ReverbTest::Clone() const
+{
+    return new ReverbTest(*this);
+}
+
 size_t ReverbTest::processInternal(float *buffer, size_t nBlocks)
 {
     assert(nBlocks > 0);
@@ -16,7 +16,10 @@ namespace agbplay
         public:
             ReverbEffect(uint8_t intesity, size_t streamRate, uint8_t numAgbBuffers);
             virtual ~ReverbEffect();
+            virtual ReverbEffect *Clone() const;
             void ProcessData(float *buffer, size_t nBlocks);
+            // clears the echo of all audio processed so far
+            virtual void Reset();
         protected:
             virtual size_t processInternal(float *buffer, size_t nBlocks);
             size_t getBlocksPerBuffer() const;
@@ -32,6 +35,8 @@ namespace agbplay
         public:
             ReverbGS1(uint8_t intensity, size_t streamRate, uint8_t numAgbBuffers);
             ~ReverbGS1() override;
+            ReverbEffect *Clone() const override;
+            void Reset() override;
         protected:
             size_t processInternal(float *buffer, size_t nBlocks) override;
             size_t getBlocksPerGsBuffer() const;
@@ -44,6 +49,8 @@ namespace agbplay
             ReverbGS2(uint8_t intesity, size_t streamRate, uint8_t numAgbBuffers,
                     float rPrimFac, float rSecFac);
             ~ReverbGS2() override;
+            ReverbEffect *Clone() const override;
+            void Reset() override;
         protected:
             size_t processInternal(float *buffer, size_t nBlocks) override;
             std::vector<float> gs2Buffer;
@@ -56,6 +63,7 @@ namespace agbplay
         public:
             ReverbTest(uint8_t intesity, size_t streamRate, uint8_t numAgbBuffers);
             ~ReverbTest() override;
+            ReverbEffect *Clone() const override;
         protected:
             size_t processInternal(float *buffer, size_t nBlocks) override;
     };
@@ -35,6 +35,8 @@ namespace agbplay {
             size_t Size();
             bool ValidPointer(agbptr_t ptr);
             std::string GetROMCode();
+            // writes a header that passes the verification, data is extended to the minimum size
+            static void WriteHeader(std::vector<uint8_t>& data, const std::string& gameCode);
         private:
             void checkBounds(long pos, size_t typesz);
             void verify();
@@ -0,0 +1,78 @@
+#include <cstdint>
+
+#include "SampleCache.h"
+#include "Resampler.h"
+
+using namespace std;
+using namespace agbplay;
+
+/*
+ * public SampleCache
+ */
+
+SampleCache& SampleCache::Instance()
+{
+    static SampleCache sc;
+    return sc;
+}
+
+const float *SampleCache::Get(const SampleInfo& sInfo)
+{
+    lock_guard<mutex> guard(lock);
+    auto it = samples.find(sInfo.samplePtr);
+    if (it != samples.end()) {
+        hits++;
+        return it->second.data;
+    }
+    misses++;
+
+    Entry& e = samples[sInfo.samplePtr];
+    // the padding in front stays zero
+    e.storage.resize(DECODED_SAMPLE_PAD + sInfo.endPos + DECODED_SAMPLE_PAD + SAMPLE_CACHE_ALIGN / sizeof(float));
+    uintptr_t addr = reinterpret_cast<uintptr_t>(e.storage.data() + DECODED_SAMPLE_PAD);
+    size_t offset = (SAMPLE_CACHE_ALIGN - addr % SAMPLE_CACHE_ALIGN) % SAMPLE_CACHE_ALIGN / sizeof(float);
+    float *data = e.storage.data() + offset + DECODED_SAMPLE_PAD;
+
+    for (uint32_t i = 0; i < sInfo.endPos; i++)
+        data[i] = float(sInfo.samplePtr[i]) * PCM_SAMPLE_SCALE;
+    // the padding at the end continues the loop like SampleStream does, otherwise it stays zero
+    if (sInfo.loopEnabled && sInfo.loopPos < sInfo.endPos) {
+        uint32_t loopLen = sInfo.endPos - sInfo.loopPos;
+        for (uint32_t i = 0; i < DECODED_SAMPLE_PAD; i++)
+            data[sInfo.endPos + i] = data[sInfo.loopPos + i % loopLen];
+    }
+
+    e.data = data;
+    bytes += e.storage.size() * sizeof(float);
+    return data;
+}
+
+size_t SampleCache::GetSampleCount()
+{
+    lock_guard<mutex> guard(lock);
+    return samples.size();
+}
+
+size_t SampleCache::GetMemoryUsage()
+{
+    lock_guard<mutex> guard(lock);
+    return bytes;
+}
+
+double SampleCache::GetHitRate()
+{
+    lock_guard<mutex> guard(lock);
+    size_t total = hits + misses;
+    return total > 0 ? double(hits) / double(total) : 0.0;
+}
+
+/*
+ * private SampleCache
+ */
+
+SampleCache::SampleCache()
+{
+    hits = 0;
+    misses = 0;
+    bytes = 0;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+#include "Types.h"
+
+// the first sample of each decoded sample is aligned for SIMD loads
+#define SAMPLE_CACHE_ALIGN 32
+
+namespace agbplay
+{
+    /*
+     * Decoded float copies of the PCM samples for the resamplers that filter them,
+     * shared by all voices and songs. A sample is decoded the first time it's played
+     * and kept while the ROM is loaded. The header of a sample is right in front of
+     * its data, so the sample pointer identifies the loop as well.
+     */
+    class SampleCache
+    {
+        public:
+            static SampleCache& Instance();
+
+            // decoded samples of sInfo, padded for SampleStream::ReadDecoded
+            const float *Get(const SampleInfo& sInfo);
+            size_t GetSampleCount();
+            size_t GetMemoryUsage();
+            // share of Get calls that found the sample decoded already
+            double GetHitRate();
+        private:
+            SampleCache();
+            struct Entry
+            {
+                std::vector<float> storage;
+                const float *data;
+            };
+
+            std::mutex lock;
+            std::unordered_map<const int8_t *, Entry> samples;
+            size_t hits;
+            size_t misses;
+            size_t bytes;
+    };
+}
@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <cmath>
+
+#include "SegmentRenderer.h"
+#include "Debug.h"
+
+using namespace std;
+using namespace agbplay;
+
+/*
+ * public SegmentRenderer
+ */
+
+SegmentRenderer::SegmentRenderer(StreamGenerator& sg, size_t threads, bool tracks, bool mixdown)
+    : sg(sg)
+{
+    this->threads = max<size_t>(threads, 1);
+    this->tracks = tracks;
+    this->mixdown = mixdown;
+    segmentFrames = size_t(roundl(SEGMENT_SECONDS * AGB_FPS * INTERFRAMES));
+    warmupFrames = size_t(roundl(SEGMENT_WARMUP_SECONDS * AGB_FPS * INTERFRAMES));
+    prePassDone = false;
+    stopping = false;
+}
+
+SegmentRenderer::~SegmentRenderer()
+{
+    stopWorkers();
+}
+
+size_t SegmentRenderer::Render(const SegmentCallback& cb)
+{
+    size_t blocksRendered = 0;
+    sg.SetSkipAudio(true);
+    segments.emplace_back(make_unique<Segment>(sg, 0, 0));
+    for (size_t i = 0; i < threads; i++) {
+        workers.emplace_back(&SegmentRenderer::workerThread, this);
+#ifdef __linux__
+        pthread_setname_np(workers.back().native_handle(), "segment worker");
+#endif
+    }
+
+    try {
+        // pre-pass: take a snapshot one warm-up period before each segment starts
+        size_t frame = 0;
+        size_t nextStart = segmentFrames;
+        while (true) {
+            sg.ProcessAndGetAudio();
+            frame++;
+            if (sg.HasStreamEnded())
+                break;
+            if (frame + warmupFrames < nextStart)
+                continue;
+
+            // don't run too far ahead of the rendering, each pending segment holds its audio
+            while (true) {
+                {
+                    lock_guard<mutex> lock(segmentLock);
+                    if (segments.size() <= threads)
+                        break;
+                }
+                blocksRendered += deliverSegments(cb, true);
+            }
+            {
+                lock_guard<mutex> lock(segmentLock);
+                segments.emplace_back(make_unique<Segment>(sg, frame, nextStart));
+            }
+            sig.notify_all();
+            nextStart += segmentFrames;
+            blocksRendered += deliverSegments(cb, false);
+        }
+        {
+            lock_guard<mutex> lock(segmentLock);
+            prePassDone = true;
+        }
+        sig.notify_all();
+
+        while (true) {
+            {
+                lock_guard<mutex> lock(segmentLock);
+                if (segments.empty())
+                    break;
+            }
+            blocksRendered += deliverSegments(cb, true);
+        }
+    } catch (...) {
+        stopWorkers();
+        sg.SetSkipAudio(false);
+        throw;
+    }
+
+    stopWorkers();
+    sg.SetSkipAudio(false);
+    return blocksRendered;
+}
+
+/*
+ * private SegmentRenderer
+ */
+
+SegmentRenderer::Segment::Segment(const StreamGenerator& sg, size_t snapshotFrame, size_t startFrame)
+    : snapshot(sg)
+{
+    this->snapshotFrame = snapshotFrame;
+    this->startFrame = startFrame;
+    this->nBlocks = 0;
+    this->state = SegmentState::QUEUED;
+}
+
+void SegmentRenderer::workerThread()
+{
+    while (true)
+    {
+        Segment *seg = nullptr;
+        {
+            unique_lock<mutex> lock(segmentLock);
+            sig.wait(lock, [&]() {
+                if (stopping || workerError)
+                    return true;
+                for (unique_ptr<Segment>& s : segments) {
+                    if (s->state == SegmentState::QUEUED) {
+                        seg = s.get();
+                        return true;
+                    }
+                }
+                return prePassDone;
+            });
+            if (seg == nullptr)
+                return;
+            seg->state = SegmentState::RENDERING;
+        }
+
+        try {
+            renderSegment(*seg);
+        } catch (...) {
+            {
+                lock_guard<mutex> lock(segmentLock);
+                if (!workerError)
+                    workerError = current_exception();
+            }
+            sig.notify_all();
+            return;
+        }
+
+        {
+            lock_guard<mutex> lock(segmentLock);
+            seg->state = SegmentState::DONE;
+        }
+        sig.notify_all();
+    }
+}
+
+void SegmentRenderer::renderSegment(Segment& seg)
+{
+    StreamGenerator& gen = seg.snapshot;
+    gen.SetSkipAudio(false);
+    gen.SetStemOutput(tracks);
+    size_t nBlocks = gen.GetBufferUnitCount();
+    if (tracks)
+        seg.tracks.resize(gen.GetWorkingSequence().tracks.size());
+    for (vector<float>& b : seg.tracks)
+        b.reserve(segmentFrames * nBlocks * N_CHANNELS);
+    if (mixdown)
+        seg.mixdown.reserve(segmentFrames * nBlocks * N_CHANNELS);
+
+    size_t frame = seg.snapshotFrame;
+    size_t endFrame = seg.startFrame + segmentFrames;
+    while (frame < endFrame)
+    {
+        // the warm-up is rendered on its own so that it can be dropped as a whole
+        bool warmup = frame < seg.startFrame;
+        size_t frames = gen.ProcessFrames(min<size_t>(RENDER_QUANTUM_FRAMES, (warmup ? seg.startFrame : endFrame) - frame));
+        frame += frames;
+        if (!warmup) {
+            vector<vector<float>>& rbuffers = gen.GetTrackAudio();
+            for (size_t i = 0; i < seg.tracks.size(); i++)
+                seg.tracks[i].insert(seg.tracks[i].end(), rbuffers[i].begin(), rbuffers[i].end());
+            if (mixdown) {
+                vector<float>& master = gen.GetMasterAudio();
+                seg.mixdown.insert(seg.mixdown.end(), master.begin(), master.end());
+            }
+            seg.nBlocks += frames * nBlocks;
+        }
+        if (gen.HasStreamEnded())
+            break;
+    }
+}
+
+size_t SegmentRenderer::deliverSegments(const SegmentCallback& cb, bool wait)
+{
+    size_t blocksDelivered = 0;
+    while (true)
+    {
+        unique_ptr<Segment> seg;
+        {
+            unique_lock<mutex> lock(segmentLock);
+            if (wait) {
+                sig.wait(lock, [&]() {
+                    return workerError || segments.empty() || segments.front()->state == SegmentState::DONE;
+                });
+            }
+            if (workerError)
+                rethrow_exception(workerError);
+            if (segments.empty() || segments.front()->state != SegmentState::DONE)
+                return blocksDelivered;
+            seg = move(segments.front());
+            segments.pop_front();
+        }
+        // only wait for the first segment
+        wait = false;
+        if (seg->nBlocks > 0)
+            cb(seg->tracks, seg->mixdown, seg->nBlocks);
+        blocksDelivered += seg->nBlocks;
+    }
+}
+
+void SegmentRenderer::stopWorkers()
+{
+    {
+        lock_guard<mutex> lock(segmentLock);
+        stopping = true;
+    }
+    sig.notify_all();
+    for (thread& t : workers)
+        t.join();
+    workers.clear();
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <vector>
+#include <list>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <exception>
+#include <cstddef>
+
+#include "StreamGenerator.h"
+
+// length of the parts a song is split into
+#define SEGMENT_SECONDS 10
+// rendering starts this long before the segment so the reverb can build up again
+#define SEGMENT_WARMUP_SECONDS 2
+
+namespace agbplay
+{
+    /*
+     * Renders a single stream on multiple threads. A serial pre-pass runs
+     * the sequencer and advances the channel state without producing any
+     * audio and takes snapshots of the whole generator at the segment
+     * boundaries. The segments are then rendered concurrently from their
+     * snapshots and passed on in stream order.
+     * The pre-pass leaves the reverb buffers empty, so each segment renders
+     * a warm-up period first. Apart from reverb tails older than the
+     * warm-up the output is identical to a serial render.
+     */
+    class SegmentRenderer
+    {
+        public:
+            // receives the audio of each segment in stream order, the tracks and the mixdown are only filled if requested
+            typedef std::function<void(std::vector<std::vector<float>>& tracks, std::vector<float>& mixdown, size_t nBlocks)> SegmentCallback;
+
+            SegmentRenderer(StreamGenerator& sg, size_t threads, bool tracks, bool mixdown);
+            ~SegmentRenderer();
+
+            // renders the whole stream and leaves sg at its end, returns the number of blocks rendered
+            size_t Render(const SegmentCallback& cb);
+        private:
+            enum class SegmentState { QUEUED, RENDERING, DONE };
+            struct Segment
+            {
+                Segment(const StreamGenerator& sg, size_t snapshotFrame, size_t startFrame);
+
+                StreamGenerator snapshot;
+                size_t snapshotFrame;
+                size_t startFrame;
+                std::vector<std::vector<float>> tracks;
+                std::vector<float> mixdown;
+                size_t nBlocks;
+                SegmentState state;
+            };
+
+            void workerThread();
+            void renderSegment(Segment& seg);
+            // passes finished segments from the front to the callback, optionally waits for the front segment
+            size_t deliverSegments(const SegmentCallback& cb, bool wait);
+            void stopWorkers();
+
+            StreamGenerator& sg;
+            size_t threads;
+            bool tracks;
+            bool mixdown;
+            size_t segmentFrames;
+            size_t warmupFrames;
+
+            std::vector<std::thread> workers;
+            std::mutex segmentLock;
+            std::condition_variable sig;
+            // segments which haven't been passed to the callback yet, guarded by segmentLock
+            std::list<std::unique_ptr<Segment>> segments;
+            bool prePassDone;
+            bool stopping;
+            std::exception_ptr workerError;
+    };
+}
@@ -8,6 +8,9 @@
 #include "Util.h"
 #include "Xcept.h"
 #include "ConfigManager.h"
+#include "Constants.h"
+#include "MixKernels.h"
+#include "SampleCache.h"
 
 using namespace agbplay;
 
@@ -15,10 +18,50 @@ using namespace agbplay;
  * public SoundChannel
  */
 
-SoundChannel::SoundChannel(uint8_t owner, SampleInfo sInfo, ADSR env, Note note, uint8_t vol, int8_t pan, int16_t pitch, bool fixed)
+SoundChannel::SoundChannel()
+{
+    this->rs = nullptr;
+    this->resamplerTypes[0] = this->resamplerTypes[1] = ResamplerType::NEAREST;
+    this->owner = 0;
+    this->prio = 0;
+    this->eState = EnvState::DEAD;
+    this->envInterStep = 0;
+    this->fixed = false;
+    this->isGS = false;
+    this->pos = 0;
+    this->interPos = 0.0f;
+    this->freq = 0.0f;
+    this->recordResampled = 0;
+    this->recordSource = 0.0;
+}
+
+SoundChannel::SoundChannel(const SoundChannel& other)
+    : pos(other.pos), interPos(other.interPos), freq(other.freq),
+    env(other.env), note(other.note), sInfo(other.sInfo), stream(other.stream), eState(other.eState),
+    fixed(other.fixed), isGS(other.isGS), owner(other.owner), prio(other.prio),
+    envInterStep(other.envInterStep), leftVol(other.leftVol), rightVol(other.rightVol),
+    envLevel(other.envLevel), fromLeftVol(other.fromLeftVol),
+    fromRightVol(other.fromRightVol), fromEnvLevel(other.fromEnvLevel),
+    recorded(other.recorded), recordBuffer(other.recordBuffer),
+    recordResampled(other.recordResampled), recordSource(other.recordSource)
+{
+    for (size_t i = 0; i < 2; i++) {
+        if (other.resamplers[i])
+            resamplers[i] = other.resamplers[i]->Clone();
+        resamplerTypes[i] = other.resamplerTypes[i];
+    }
+    rs = other.rs ? resamplers[fixed ? 1 : 0].get() : nullptr;
+}
+
+SoundChannel::~SoundChannel()
+{
+}
+
+void SoundChannel::Init(uint8_t owner, SampleInfo sInfo, ADSR env, Note note, uint8_t vol, int8_t pan, int16_t pitch, bool fixed, uint8_t prio)
 {
     GameConfig& cfg = ConfigManager::Instance().GetCfg();
     this->owner = owner;
+    this->prio = prio;
     this->note = note;
     this->env = env;
     this->sInfo = sInfo;
@@ -29,21 +72,31 @@ SoundChannel::SoundChannel(uint8_t owner, SampleInfo sInfo, ADSR env, Note note,
     SetVol(vol, pan);
     this->fixed = fixed;
 
+    // the resamplers stay with the voice, so later notes reuse them and their fetch buffers
     ResamplerType t = fixed ? cfg.GetResTypeFixed() : cfg.GetResType();
-    switch (t) {
-    case ResamplerType::NEAREST:
-        this->rs = std::make_unique<NearestResampler>();
-        break;
-    case ResamplerType::LINEAR:
-        this->rs = std::make_unique<LinearResampler>();
-        break;
-    case ResamplerType::SINC:
-        this->rs = std::make_unique<SincResampler>();
-        break;
-    case ResamplerType::BLEP:
-        this->rs = std::make_unique<BlepResampler>();
-        break;
+    // on the engine rate bus fixed voices don't need resampling and the bus gets the expensive filter
+    if (cfg.GetEngineRateMix())
+        t = fixed ? ResamplerType::NEAREST : ResamplerType::LINEAR;
+    std::unique_ptr<Resampler>& slot = resamplers[fixed ? 1 : 0];
+    if (!slot || resamplerTypes[fixed ? 1 : 0] != t) {
+        switch (t) {
+        case ResamplerType::NEAREST:
+            slot = std::make_unique<NearestResampler>();
+            break;
+        case ResamplerType::LINEAR:
+            slot = std::make_unique<LinearResampler>();
+            break;
+        case ResamplerType::SINC:
+            slot = std::make_unique<SincResampler>();
+            break;
+        case ResamplerType::BLEP:
+            slot = std::make_unique<BlepResampler>();
+            break;
+        }
+        resamplerTypes[fixed ? 1 : 0] = t;
     }
+    this->rs = slot.get();
+    this->rs->Reset();
 
     this->interPos = 0.0f;
     SetPitch(pitch);
@@ -54,53 +107,119 @@ SoundChannel::SoundChannel(uint8_t owner, SampleInfo sInfo, ADSR env, Note note,
     } else {
         this->isGS = false;
     }
+    const float *decoded = nullptr;
+    if (!isGS && rs->ReadsDecoded())
+        decoded = SampleCache::Instance().Get(sInfo);
+    this->stream.Init(sInfo.samplePtr, decoded, sInfo.loopPos, sInfo.endPos, sInfo.loopEnabled);
 }
 
-SoundChannel::~SoundChannel()
+void SoundChannel::Process(float *buffer, size_t nblocks, const MixingArgs& args)
 {
+    stepEnvelope();
+    if (GetState() == EnvState::DEAD)
+        return;
+    if (nblocks == 0)
+        return;
+
+    ProcArgs cargs = getProcArgs(nblocks, args);
+    if (isGS)
+        processGS(buffer, nblocks, cargs);
+    else
+        processNormal(buffer, nblocks, cargs);
+    updateVolFade();
 }
 
-void SoundChannel::Process(float *buffer, size_t nblocks, const MixingArgs& args)
+void SoundChannel::Skip(size_t nblocks, const MixingArgs& args)
 {
+    if (isGS) {
+        // synthesized waveforms carry their state in the generated samples, so just render them
+        float scratch[nblocks * N_CHANNELS];
+        std::fill(scratch, scratch + nblocks * N_CHANNELS, 0.0f);
+        Process(scratch, nblocks, args);
+        return;
+    }
+
     stepEnvelope();
     if (GetState() == EnvState::DEAD)
         return;
     if (nblocks == 0)
         return;
 
-    float nBlocksReciprocal = 1.f / float(nblocks);
+    if (!rs->SkipSample(nblocks, getInterStep(args), stream))
+        Kill();
+    updateVolFade();
+}
 
-    ChnVol vol = getVol();
-    vol.fromVolLeft *= args.vol;
-    vol.fromVolRight *= args.vol;
-    vol.toVolLeft *= args.vol;
-    vol.toVolRight *= args.vol;
+void SoundChannel::Record(size_t frame, size_t nblocks, const MixingArgs& args)
+{
+    stepEnvelope();
+    if (GetState() == EnvState::DEAD)
+        return;
+    if (nblocks == 0)
+        return;
 
-    ProcArgs cargs;
-    cargs.lVolStep = (vol.toVolLeft - vol.fromVolLeft) * nBlocksReciprocal;
-    cargs.rVolStep = (vol.toVolRight - vol.fromVolRight) * nBlocksReciprocal;
-    cargs.lVol = vol.fromVolLeft;
-    cargs.rVol = vol.fromVolRight;
+    RecordedFrame rf;
+    rf.frame = frame;
+    rf.cargs = getProcArgs(nblocks, args);
+    rf.envInterStep = envInterStep;
+    recorded.push_back(rf);
+    recordSource += double(rf.cargs.interStep) * double(nblocks);
+    /*
+     * The frame in which a sample ends decides when the voice dies, which the sequencer sees.
+     * Close to the end every frame is resampled right away, so it dies in the same frame as with Process.
+     */
+    if (!sInfo.loopEnabled && double(stream.GetPos()) + recordSource + RECORD_END_MARGIN >= double(sInfo.endPos)) {
+        resampleRecorded(nblocks, recorded.size() - 1);
+        resampleRecorded(nblocks, recorded.size());
+    }
+    updateVolFade();
+}
 
-    if (fixed && !isGS)
-        cargs.interStep = float(args.fixedModeRate) * args.sampleRateReciprocal;
-    else 
-        cargs.interStep = freq * args.sampleRateReciprocal;
+void SoundChannel::RenderRecorded(float *buffer, size_t nblocks, size_t frames, std::vector<float>& scratch)
+{
+    size_t i = 0;
+    while (i < recorded.size() && recorded[i].frame < frames)
+    {
+        if (isGS) {
+            // the waveform state only changes here, so it can be rendered later just as well
+            uint8_t curInterStep = envInterStep;
+            envInterStep = recorded[i].envInterStep;
+            ProcArgs cargs = recorded[i].cargs;
+            processGS(buffer + recorded[i].frame * nblocks * N_CHANNELS, nblocks, cargs);
+            envInterStep = curInterStep;
+            i++;
+            continue;
+        }
 
-    if (isGS) {
-        cargs.interStep /= 64.f; // different scale for GS
-        // switch by GS type
-        if (sInfo.samplePtr[1] == 0) {
-            processModPulse(buffer, nblocks, cargs, nBlocksReciprocal);
-        } else if (sInfo.samplePtr[1] == 1) {
-            processSaw(buffer, nblocks, cargs);
+        const float *src;
+        size_t runEnd;
+        bool running = true;
+        if (i < recordResampled) {
+            src = recordBuffer.data() + i * nblocks;
+            runEnd = i + 1;
         } else {
-            processTri(buffer, nblocks, cargs);
+            // the audio goes to the track right away, so the scratch stays in the cache
+            runEnd = recordedRunEnd(i, recorded.size());
+            scratch.resize((runEnd - i) * nblocks);
+            running = rs->ProcessSample(scratch.data(), scratch.size(), recorded[i].cargs.interStep, stream);
+            src = scratch.data();
+        }
+        for (size_t j = i; j < runEnd && recorded[j].frame < frames; j++)
+        {
+            const RecordedFrame& rf = recorded[j];
+            MixKernels::MixMonoRamp(buffer + rf.frame * nblocks * N_CHANNELS, src + (j - i) * nblocks, nblocks,
+                    rf.cargs.lVol, rf.cargs.rVol, rf.cargs.lVolStep, rf.cargs.rVolStep);
+        }
+        i = runEnd;
+        if (!running) {
+            Kill();
+            break;
         }
-    } else {
-        processNormal(buffer, nblocks, cargs);
     }
-    updateVolFade();
+    recorded.clear();
+    recordBuffer.clear();
+    recordResampled = 0;
+    recordSource = 0.0;
 }
 
 uint8_t SoundChannel::GetOwner()
@@ -108,6 +227,11 @@ uint8_t SoundChannel::GetOwner()
     return owner;
 }
 
+uint8_t SoundChannel::GetPriority()
+{
+    return prio;
+}
+
 void SoundChannel::SetVol(uint8_t vol, int8_t pan)
 {
     GameConfig& cfg = ConfigManager::Instance().GetCfg();
@@ -265,6 +389,67 @@ void SoundChannel::stepEnvelope()
     }
 }
 
+float SoundChannel::getInterStep(const MixingArgs& args)
+{
+    if (isGS)
+        return freq * args.sampleRateReciprocal / 64.f; // different scale for GS
+    else if (fixed)
+        return float(args.fixedModeRate) * args.sampleRateReciprocal;
+    else
+        return freq * args.sampleRateReciprocal;
+}
+
+SoundChannel::ProcArgs SoundChannel::getProcArgs(size_t nblocks, const MixingArgs& args)
+{
+    float nBlocksReciprocal = 1.f / float(nblocks);
+
+    ChnVol vol = getVol();
+    vol.fromVolLeft *= args.vol;
+    vol.fromVolRight *= args.vol;
+    vol.toVolLeft *= args.vol;
+    vol.toVolRight *= args.vol;
+
+    ProcArgs cargs;
+    cargs.lVolStep = (vol.toVolLeft - vol.fromVolLeft) * nBlocksReciprocal;
+    cargs.rVolStep = (vol.toVolRight - vol.fromVolRight) * nBlocksReciprocal;
+    cargs.lVol = vol.fromVolLeft;
+    cargs.rVol = vol.fromVolRight;
+    cargs.interStep = getInterStep(args);
+    return cargs;
+}
+
+size_t SoundChannel::recordedRunEnd(size_t begin, size_t end)
+{
+    // consecutive frames with the same pitch are a single call to the resampler
+    size_t runEnd = begin + 1;
+    while (runEnd < end && recorded[runEnd].frame == recorded[runEnd - 1].frame + 1 &&
+            recorded[runEnd].cargs.interStep == recorded[begin].cargs.interStep)
+        runEnd++;
+    return runEnd;
+}
+
+void SoundChannel::resampleRecorded(size_t nblocks, size_t end)
+{
+    recordBuffer.resize(recorded.size() * nblocks);
+    size_t i = recordResampled;
+    while (i < end)
+    {
+        size_t runEnd = recordedRunEnd(i, end);
+        bool running = rs->ProcessSample(recordBuffer.data() + i * nblocks, (runEnd - i) * nblocks,
+                recorded[i].cargs.interStep, stream);
+        i = runEnd;
+        if (!running) {
+            // like Process, nothing plays after the frame in which the sample ended
+            Kill();
+            recorded.resize(i);
+            break;
+        }
+    }
+    recordResampled = i;
+    if (recordResampled == recorded.size())
+        recordSource = 0.0;
+}
+
 void SoundChannel::updateVolFade()
 {
     fromLeftVol = leftVol;
@@ -280,21 +465,26 @@ void SoundChannel::processNormal(float *buffer, size_t nblocks, ProcArgs& cargs)
         return;
     float outBuffer[nblocks];
 
-    bool running = rs->Process(outBuffer, nblocks, cargs.interStep, sampleFetchCallback, this);
+    bool running = rs->ProcessSample(outBuffer, nblocks, cargs.interStep, stream);
 
-    size_t i = 0;
-    do {
-        float samp = outBuffer[i++];
-
-        *buffer++ += samp * cargs.lVol;
-        *buffer++ += samp * cargs.rVol;
-        cargs.lVol += cargs.lVolStep;
-        cargs.rVol += cargs.rVolStep;
-    } while (--nblocks > 0);
+    MixKernels::MixMonoRamp(buffer, outBuffer, nblocks,
+            cargs.lVol, cargs.rVol, cargs.lVolStep, cargs.rVolStep);
     if (!running)
         Kill();
 }
 
+void SoundChannel::processGS(float *buffer, size_t nblocks, ProcArgs& cargs)
+{
+    // switch by GS type
+    if (sInfo.samplePtr[1] == 0) {
+        processModPulse(buffer, nblocks, cargs, 1.f / float(nblocks));
+    } else if (sInfo.samplePtr[1] == 1) {
+        processSaw(buffer, nblocks, cargs);
+    } else {
+        processTri(buffer, nblocks, cargs);
+    }
+}
+
 void SoundChannel::processModPulse(float *buffer, size_t nblocks, ProcArgs& cargs, float nBlocksReciprocal)
 {
 #define DUTY_BASE 2
@@ -392,33 +582,3 @@ void SoundChannel::processTri(float *buffer, size_t nblocks, ProcArgs& cargs)
         cargs.rVol += cargs.rVolStep;
     } while (--nblocks > 0);
 }
-
-bool SoundChannel::sampleFetchCallback(std::vector<float>& fetchBuffer, size_t samplesRequired, void *cbdata)
-{
-    if (fetchBuffer.size() >= samplesRequired)
-        return true;
-    SoundChannel *_this = static_cast<SoundChannel *>(cbdata);
-    size_t samplesToFetch = samplesRequired - fetchBuffer.size();
-    size_t i = fetchBuffer.size();
-    fetchBuffer.resize(samplesRequired);
-
-    do {
-        size_t samplesTilLoop = _this->sInfo.endPos - _this->pos;
-        size_t thisFetch = std::min(samplesTilLoop, samplesToFetch);
-
-        samplesToFetch -= thisFetch;
-        do {
-            fetchBuffer[i++] = float(_this->sInfo.samplePtr[_this->pos++]) / 128.0f;
-        } while (--thisFetch > 0);
-
-        if (_this->pos >= _this->sInfo.endPos) {
-            if (_this->sInfo.loopEnabled) {
-                _this->pos = _this->sInfo.loopPos;
-            } else {
-                std::fill(fetchBuffer.begin() + i, fetchBuffer.end(), 0.0f);
-                return false;
-            }
-        }
-    } while (samplesToFetch > 0);
-    return true;
-}
@@ -7,6 +7,9 @@
 #include "Types.h"
 #include "Resampler.h"
 
+// source samples kept between recorded frames and the end of a sample, see SoundChannel::Record
+#define RECORD_END_MARGIN 64
+
 namespace agbplay
 {
     class SoundChannel
@@ -20,11 +23,31 @@ namespace agbplay
                 float rVolStep;
                 float interStep;
             };
+            struct RecordedFrame
+            {
+                size_t frame;
+                ProcArgs cargs;
+                // synthesized waveforms depend on the envelope position
+                uint8_t envInterStep;
+            };
         public:
-            SoundChannel(uint8_t owner, SampleInfo sInfo, ADSR env, Note note, uint8_t vol, int8_t pan, int16_t pitch, bool fixed);
+            // creates an unused (dead) voice, Init starts a note on it
+            SoundChannel();
+            SoundChannel(const SoundChannel& other);
+            SoundChannel(SoundChannel&& other) = default;
             ~SoundChannel();
+            void Init(uint8_t owner, SampleInfo sInfo, ADSR env, Note note, uint8_t vol, int8_t pan, int16_t pitch, bool fixed, uint8_t prio);
             void Process(float *buffer, size_t nblocks, const MixingArgs& args);
+            // advances the channel like Process does, but without mixing any audio
+            void Skip(size_t nblocks, const MixingArgs& args);
+            // advances the channel like Process does, but only records the volume ramps and pitch
+            // of the frame so that RenderRecorded can resample many frames in a single call
+            void Record(size_t frame, size_t nblocks, const MixingArgs& args);
+            // mixes the recorded frames before 'frames' to buffer, which starts at frame 0,
+            // scratch holds the resampled audio of one call and can be shared by all voices
+            void RenderRecorded(float *buffer, size_t nblocks, size_t frames, std::vector<float>& scratch);
             uint8_t GetOwner();
+            uint8_t GetPriority();
             void SetVol(uint8_t vol, int8_t pan);
             uint8_t GetMidiKey();
             int8_t GetNoteLength();
@@ -39,22 +62,32 @@ namespace agbplay
             void stepEnvelope();
             void updateVolFade();
             ChnVol getVol();
+            float getInterStep(const MixingArgs& args);
+            ProcArgs getProcArgs(size_t nblocks, const MixingArgs& args);
+            size_t recordedRunEnd(size_t begin, size_t end);
+            void resampleRecorded(size_t nblocks, size_t end);
             void processNormal(float *buffer, size_t nblocks, ProcArgs& cargs);
+            void processGS(float *buffer, size_t nblocks, ProcArgs& cargs);
             void processModPulse(float *buffer, size_t nblocks, ProcArgs& cargs, float nBlocksReciprocal);
             void processSaw(float *buffer, size_t nblocks, ProcArgs& cargs);
             void processTri(float *buffer, size_t nblocks, ProcArgs& cargs);
-            static bool sampleFetchCallback(std::vector<float>& fetchBuffer, size_t samplesRequired, void *cbdata);
-            std::unique_ptr<Resampler> rs;
+            // one resampler for regular and one for fixed frequency notes, rs points to the active one
+            std::unique_ptr<Resampler> resamplers[2];
+            ResamplerType resamplerTypes[2];
+            Resampler *rs;
             uint32_t pos;
             float interPos;
             float freq;
             ADSR env;
             Note note;
             SampleInfo sInfo;
+            // the PCM sample, pos is only used by synthesized waveforms
+            SampleStream stream;
             EnvState eState;
             bool fixed;
             bool isGS;
             uint8_t owner;
+            uint8_t prio;
             uint8_t envInterStep;
             uint8_t leftVol;
             uint8_t rightVol;
@@ -63,5 +96,11 @@ namespace agbplay
             uint8_t fromLeftVol;
             uint8_t fromRightVol;
             uint8_t fromEnvLevel;
+            // frames recorded since the last RenderRecorded and the audio of the ones that had to be resampled right away
+            std::vector<RecordedFrame> recorded;
+            std::vector<float> recordBuffer;
+            size_t recordResampled;
+            // estimated source samples that the recorded frames will still fetch
+            double recordSource;
     };
 }
@@ -2,6 +2,7 @@
 #include <iostream>
 #include <cassert>
 #include <algorithm>
+#include <set>
 
 #include "AgbTypes.h"
 #include "SoundData.h"
@@ -12,6 +13,9 @@
 using namespace agbplay;
 using namespace std;
 
+// don't walk forever through tracks that lack a FINE
+#define SONG_HASH_MAX_TRACK_LEN 0x10000
+
 /*
  * public SoundBank
  */
@@ -307,6 +311,11 @@ uint8_t Sequence::GetReverb()
     return reverb;
 }
 
+uint8_t Sequence::GetPriority()
+{
+    return prio;
+}
+
 /*
  * public
  * Track
@@ -327,7 +336,7 @@ Sequence::Track::Track(long pos)
     vol = 100;
     lfos = 22;
     delay = mod = reptCount = lfodl = 
-        lfodlCount = lfoPhase = echoVol = echoLen = 0;
+        lfodlCount = lfoPhase = echoVol = echoLen = prio = 0;
     bendr = 2;
     pan = bend = tune = keyShift = 0;
     muted = false;
@@ -407,6 +416,29 @@ unsigned short SongTable::GetNumSongs() {
     return numSongs;
 }
 
+bool SongTable::IsSongEmpty(uint16_t uid) {
+    rom.Seek(GetPosOfSong(uid));
+    return rom.ReadUInt32() == 0;
+}
+
+uint64_t SongTable::GetSongHash(uint16_t uid) {
+    return HashSong(rom, GetPosOfSong(uid));
+}
+
+uint64_t SongTable::HashSong(Rom& rom, long songPos) {
+    rom.Seek(songPos);
+    uint8_t nTracks = rom.ReadUInt8();
+    uint64_t hash = FNV_HASH_INIT;
+    // track count, blocks, prio, reverb and voicegroup
+    for (int i = 0; i < 8; i++)
+        HashByte(hash, rom[songPos + i]);
+    for (uint8_t i = 0; i < nTracks; i++) {
+        rom.Seek(songPos + 8 + 4 * i);
+        hashTrack(rom, rom.ReadAGBPtrToPos(), hash);
+    }
+    return hash;
+}
+
 /*
  * private
  */
@@ -506,6 +538,87 @@ bool SongTable::validateSong(agbptr_t ptr)
     return true;
 }
 
+void SongTable::hashTrack(Rom& rom, long trackPos, uint64_t& hash)
+{
+    // walks the track commands up to FINE and the bodies of all PATT, REPT and GOTO targets,
+    // every target once; targets are hashed relative to the track start so relocated copies
+    // hash equally, the order of the walk only depends on the track data
+    vector<pair<long, bool>> targets;
+    targets.emplace_back(trackPos, false);
+    set<long> visited;
+    while (!targets.empty()) {
+        long pos = targets.back().first;
+        // patterns end at PEND, the track and jump targets at FINE or GOTO
+        bool pattern = targets.back().second;
+        targets.pop_back();
+        if (pos < 0 || !visited.insert(pos).second)
+            continue;
+        uint32_t relStart = uint32_t(pos - trackPos);
+        for (int i = 0; i < 4; i++)
+            HashByte(hash, uint8_t(relStart >> (i * 8)));
+        long end = min<long>(pos + SONG_HASH_MAX_TRACK_LEN, (long)rom.Size() - 4);
+        bool segmentEnd = false;
+        while (pos < end && !segmentEnd) {
+            uint8_t cmd = rom[pos++];
+            HashByte(hash, cmd);
+            int args = 0;
+            switch (cmd) {
+                case 0xB1:
+                    // FINE
+                    segmentEnd = true;
+                    break;
+                case 0xB2:
+                    // GOTO
+                    args = -1;
+                    segmentEnd = true;
+                    break;
+                case 0xB3:
+                    // PATT
+                    args = -1;
+                    break;
+                case 0xB4:
+                    // PEND
+                    segmentEnd = pattern;
+                    break;
+                case 0xB5:
+                    // REPT
+                    HashByte(hash, rom[pos++]);
+                    args = -1;
+                    break;
+                case 0xB9:
+                    // MEMACC
+                    args = 3;
+                    break;
+                case 0xBA: case 0xBB: case 0xBC: case 0xBD: case 0xBE: case 0xBF:
+                case 0xC0: case 0xC1: case 0xC2: case 0xC3: case 0xC4: case 0xC5:
+                case 0xC8:
+                    args = 1;
+                    break;
+                case 0xCD:
+                    // XCMD
+                    args = 2;
+                    break;
+                default:
+                    // running status, delays and notes only use arguments < 0x80
+                    break;
+            }
+            if (args < 0) {
+                rom.Seek(pos);
+                agbptr_t targetPtr = rom.ReadUInt32();
+                long target = rom.AGBPtrToPos(targetPtr);
+                uint32_t rel = uint32_t(target - trackPos);
+                for (int i = 0; i < 4; i++)
+                    HashByte(hash, uint8_t(rel >> (i * 8)));
+                if (rom.ValidPointer(targetPtr))
+                    targets.emplace_back(target, cmd != 0xB2);
+                pos += 4;
+            }
+            for (int i = 0; i < args; i++)
+                HashByte(hash, rom[pos++]);
+        }
+    }
+}
+
 unsigned short SongTable::determineNumSongs() 
 {
     long pos = songTable;
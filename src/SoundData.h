@@ -80,6 +80,8 @@ namespace agbplay
             Rom& GetRom();
             long GetSndBnk();
             uint8_t GetReverb();
+            // priority from the song header, the tracks' PRIO adds to it
+            uint8_t GetPriority();
         private:
             Rom rom;
             long songHeader;
@@ -98,11 +100,17 @@ namespace agbplay
             long GetSongTablePos();
             long GetPosOfSong(uint16_t uid);
             unsigned short GetNumSongs();
+            // songs with an all zero header don't play anything
+            bool IsSongEmpty(uint16_t uid);
+            // songs with equal hashes play the same, no matter where their data is located
+            uint64_t GetSongHash(uint16_t uid);
+            static uint64_t HashSong(Rom& rom, long songPos);
         private:
             long locateSongTable();
             bool validateTableEntry(long pos);
             bool validateSong(agbptr_t checkPtr);
             unsigned short determineNumSongs();
+            static void hashTrack(Rom& rom, long trackPos, uint64_t& hash);
 
             Rom& rom;
             long songTable;
@@ -4,34 +4,106 @@
 #undef BOOST_FILESYSTEM_NO_DEPRECATED
 #include <boost/algorithm/string/replace.hpp>
 #include <chrono>
+#include <cmath>
 #include <climits>
+#include <algorithm>
+#include <map>
+#include <fstream>
+#include <iomanip>
+#include <memory>
 
 #include "SoundExporter.h"
+#include "SoundFileWriter.h"
+#include "SegmentRenderer.h"
 #include "Util.h"
 #include "Xcept.h"
 #include "Constants.h"
 #include "Debug.h"
 #include "ConfigManager.h"
+#include "MixKernels.h"
+#include "SampleCache.h"
 
 using namespace agbplay;
 using namespace std;
 
+// number of floats per write chunk and number of chunks queued per song
+#define EXPORT_CHUNK_SIZE (1 << 18)
+#define EXPORT_QUEUE_CHUNKS 8
+// SF_FORMAT_OPUS, only available as enum value in libsndfile 1.0.29 and newer
+#define EXPORT_SF_FORMAT_OPUS 0x0064
+
+struct FormatDef
+{
+    const char *name;
+    const char *description;
+    const char *extension;
+    int sfFormat;
+    unsigned ditherBits;
+};
+
+// indexed by ExportFormat
+static const FormatDef formatDefs[] = {
+    { "wav",    "WAV 32 bit float", "wav",  SF_FORMAT_WAV | SF_FORMAT_FLOAT,       0  },
+    { "wav16",  "WAV 16 bit",       "wav",  SF_FORMAT_WAV | SF_FORMAT_PCM_16,      16 },
+    { "wav24",  "WAV 24 bit",       "wav",  SF_FORMAT_WAV | SF_FORMAT_PCM_24,      24 },
+    { "flac16", "FLAC 16 bit",      "flac", SF_FORMAT_FLAC | SF_FORMAT_PCM_16,     16 },
+    { "flac",   "FLAC 24 bit",      "flac", SF_FORMAT_FLAC | SF_FORMAT_PCM_24,     24 },
+    { "ogg",    "Ogg Vorbis",       "ogg",  SF_FORMAT_OGG | SF_FORMAT_VORBIS,      0  },
+    { "opus",   "Ogg Opus",         "opus", SF_FORMAT_OGG | EXPORT_SF_FORMAT_OPUS, 0  },
+};
+
+// stores a forward loop (sample frames, end exclusive) as smpl chunk, only before any audio is written
+static bool storeLoop(SNDFILE *file, size_t loopStart, size_t loopEnd)
+{
+    SF_INSTRUMENT inst;
+    memset(&inst, 0, sizeof(inst));
+    inst.gain = 1;
+    inst.basenote = 60;
+    inst.velocity_lo = 1;
+    inst.velocity_hi = 127;
+    inst.key_lo = 0;
+    inst.key_hi = 127;
+    inst.loop_count = 1;
+    inst.loops[0].mode = SF_LOOP_FORWARD;
+    inst.loops[0].start = uint32_t(loopStart);
+    inst.loops[0].end = uint32_t(loopEnd);
+    inst.loops[0].count = 0;
+    return sf_command(file, SFC_SET_INSTRUMENT, &inst, sizeof(inst)) == SF_TRUE;
+}
+
 /*
  * public SoundExporter
  */
 
-SoundExporter::SoundExporter(ConsoleGUI& _con, SoundData& _sd, Rom& _rom, bool _benchmarkOnly, bool seperate)
-: con(_con), sd(_sd), rom(_rom)
+SoundExporter::SoundExporter(SoundData& _sd, Rom& _rom, bool _benchmarkOnly, ExportMode mode, size_t threads)
+: sd(_sd), rom(_rom)
 {
     benchmarkOnly = _benchmarkOnly;
-    this->seperate = seperate;
+    this->mode = mode;
+    multichannel = false;
+    loopExport = false;
+    deduplicate = false;
+    cacheDir = ConfigManager::Instance().GetCfg().GetRenderCache();
+    // exports don't depend on the audio device, so they use the default rate unless configured
+    sampleRate = ConfigManager::Instance().GetCfg().GetSampleRate();
+    if (sampleRate == 0)
+        sampleRate = STREAM_SAMPLERATE;
+    cache = nullptr;
+    format = ExportFormat::WAV_FLOAT;
+    if (threads == 0)
+        threads = thread::hardware_concurrency();
+    this->threads = max<size_t>(threads, 1);
+    segmented = false;
+    segmentThreads = 1;
+    verifySegments = false;
+    kernelError = 0.0f;
 }
 
 SoundExporter::~SoundExporter()
 {
 }
 
-void SoundExporter::Export(const string& outputDir, vector<SongEntry>& entries, vector<bool>& ticked)
+bool SoundExporter::Export(const string& outputDir, vector<SongEntry>& entries, vector<bool>& ticked)
 {
     if (entries.size() != ticked.size())
         throw Xcept("SoundExporter: input vectors do not match");
@@ -43,6 +115,10 @@ void SoundExporter::Export(const string& outputDir, vector<SongEntry>& entries,
     }
 
 
+    if (format == ExportFormat::OGG_OPUS && sampleRate != 48000 && sampleRate != 24000 &&
+            sampleRate != 16000 && sampleRate != 12000 && sampleRate != 8000)
+        throw Xcept("Opus only supports 8, 12, 16, 24 and 48 kHz, not %u Hz", sampleRate);
+
     boost::filesystem::path dir(outputDir);
     if (boost::filesystem::exists(dir)) {
         if (!boost::filesystem::is_directory(dir)) {
@@ -53,146 +129,616 @@ void SoundExporter::Export(const string& outputDir, vector<SongEntry>& entries,
         throw Xcept("Creating output directory failed");
     }
 
-    size_t totalBlocksRendered = 0;
-
-    auto startTime = chrono::high_resolution_clock::now();
-
+    // song positions and hashes are resolved here since the song table seeks the shared ROM
+    vector<ExportJob> jobs;
+    vector<ExportJob> duplicates;
+    vector<size_t> originals;
+    vector<ExportJob> emptySongs;
+    map<uint64_t, size_t> uniqueSongs;
     for (size_t i = 0; i < tEnts.size(); i++)
     {
-        string fname = tEnts[i].name;
-        boost::replace_all(fname, "/", "_");
-        _print_debug("%3d %% - Rendering to file: \"%s\"", (i + 1) * 100 / tEnts.size(), fname.c_str());
+        ExportJob job;
+        job.uid = tEnts[i].GetUID();
+        job.name = tEnts[i].name;
+        boost::replace_all(job.name, "/", "_");
         char fileName[512];
-        snprintf(fileName, sizeof(fileName), "%s/%03zu - %s", outputDir.c_str(), i + 1, fname.c_str());
-        size_t rblocks = exportSong(fileName, tEnts[i].GetUID());
-        totalBlocksRendered += rblocks;
+        snprintf(fileName, sizeof(fileName), "%s/%03zu - %s", outputDir.c_str(), i + 1, job.name.c_str());
+        job.fileName = fileName;
+        job.songPos = sd.sTable->GetPosOfSong(job.uid);
+        job.blocksRendered = 0;
+        job.renderTime = 0.0;
+        job.writeTime = 0.0;
+        job.samplesWritten = 0;
+        job.cached = false;
+        job.done = false;
+        if (deduplicate) {
+            if (sd.sTable->IsSongEmpty(job.uid)) {
+                emptySongs.push_back(job);
+                continue;
+            }
+            uint64_t hash = sd.sTable->GetSongHash(job.uid);
+            auto original = uniqueSongs.find(hash);
+            if (original != uniqueSongs.end()) {
+                duplicates.push_back(job);
+                originals.push_back(original->second);
+                continue;
+            }
+            uniqueSongs[hash] = jobs.size();
+        }
+        jobs.push_back(job);
+    }
+    if (deduplicate) {
+        _print_debug("Rendering %zu unique songs, skipping %zu duplicates and %zu empty songs",
+                jobs.size(), duplicates.size(), emptySongs.size());
+    }
+
+    nextJob = 0;
+    nextReport = 0;
+    workerError = nullptr;
+    writeError = false;
+
+    if (benchmarkOnly) {
+        kernelError = MixKernels::SelfTest();
+        _print_debug("Mixing kernels: %s (max. relative error of all supported sets %g)", MixKernels::GetInstructionSet(), double(kernelError));
+        if (kernelError > MIX_KERNELS_TOLERANCE) {
+            _print_debug("Error: mixing kernels differ from the scalar reference, see --self-test");
+            writeError = true;
+        }
     }
 
+    unique_ptr<RenderCache> renderCache;
+    if (!benchmarkOnly && !cacheDir.empty())
+        renderCache = make_unique<RenderCache>(cacheDir);
+    cache = renderCache.get();
+
+    auto startTime = chrono::high_resolution_clock::now();
+
+    size_t nThreads = min(threads, jobs.size());
+    // threads that aren't needed for separate songs help rendering the songs in segments
+    segmentThreads = (segmented || verifySegments) && nThreads > 0 ? threads / nThreads : 1;
+    vector<thread> workers;
+    for (size_t i = 0; i < nThreads; i++) {
+        workers.emplace_back(&SoundExporter::workerThread, this, ref(jobs));
+#ifdef __linux__
+        pthread_setname_np(workers.back().native_handle(), "export worker");
+#endif
+    }
+    for (thread& t : workers)
+        t.join();
+
+    cache = nullptr;
+    if (workerError)
+        rethrow_exception(workerError);
+
     auto endTime = chrono::high_resolution_clock::now();
 
-    if (chrono::duration_cast<chrono::seconds>(endTime - startTime).count() == 0) {
-        _print_debug("Successfully wrote %zu files", tEnts.size());
+    if (deduplicate && !benchmarkOnly)
+        writeManifest(outputDir, jobs, duplicates, originals, emptySongs);
+
+    size_t totalBlocksRendered = 0;
+    double totalRenderTime = 0.0;
+    double totalWriteTime = 0.0;
+    size_t totalSamplesWritten = 0;
+    size_t cachedSongs = 0;
+    for (ExportJob& job : jobs) {
+        if (job.cached)
+            cachedSongs++;
+        totalBlocksRendered += job.blocksRendered;
+        totalRenderTime += job.renderTime;
+        totalWriteTime += job.writeTime;
+        totalSamplesWritten += job.samplesWritten;
+    }
+
+    double wallTime = chrono::duration<double>(endTime - startTime).count();
+    if (wallTime <= 0.0) {
+        _print_debug("Successfully wrote %zu files", jobs.size());
     } else {
-        _print_debug("Successfully wrote %d files at %d blocks per second",
-                    tEnts.size(), 
-                    int(totalBlocksRendered / (size_t)chrono::duration_cast<chrono::seconds>(endTime - startTime).count()));
+        _print_debug("Successfully wrote %zu files at %.0f blocks per second (%.1fx real time)",
+                    jobs.size(), double(totalBlocksRendered) / wallTime,
+                    double(totalBlocksRendered) / sampleRate / wallTime);
+    }
+    if (cachedSongs > 0)
+        _print_debug("%zu songs were taken from the render cache", cachedSongs);
+    if (benchmarkOnly)
+        _print_debug("Render time: %.2f s", totalRenderTime);
+    else
+        _print_debug("Render time: %.2f s, write time: %.2f s", totalRenderTime, totalWriteTime);
+    if (!benchmarkOnly && totalWriteTime > 0.0) {
+        _print_debug("%s encoding: %.2f MSamples/s",
+                formatDefs[static_cast<int>(format)].description,
+                double(totalSamplesWritten) / totalWriteTime / 1000000.0);
+    }
+    if (benchmarkOnly)
+        writeReport(reportFile.empty() ? outputDir + "/benchmark.json" : reportFile, jobs, wallTime);
+    return !writeError;
+}
+
+void SoundExporter::SetMultichannel(bool multichannel)
+{
+    this->multichannel = multichannel;
+}
+
+void SoundExporter::SetLoopExport(bool loopExport)
+{
+    this->loopExport = loopExport;
+}
+
+void SoundExporter::SetDeduplicate(bool deduplicate)
+{
+    this->deduplicate = deduplicate;
+}
+
+void SoundExporter::SetReportFile(const string& reportFile)
+{
+    this->reportFile = reportFile;
+}
+
+void SoundExporter::SetRenderCache(const string& cacheDir)
+{
+    this->cacheDir = cacheDir;
+}
+
+void SoundExporter::SetSampleRate(uint32_t sampleRate)
+{
+    this->sampleRate = sampleRate;
+}
+
+void SoundExporter::SetSegmented(bool segmented)
+{
+    this->segmented = segmented;
+}
+
+void SoundExporter::SetVerifySegments(bool verifySegments)
+{
+    this->verifySegments = verifySegments;
+}
+
+void SoundExporter::SetFormat(ExportFormat format)
+{
+    this->format = format;
+}
+
+bool SoundExporter::ParseFormat(const string& name, ExportFormat& format)
+{
+    for (size_t i = 0; i < sizeof(formatDefs) / sizeof(formatDefs[0]); i++) {
+        if (name == formatDefs[i].name) {
+            format = static_cast<ExportFormat>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+string SoundExporter::FormatNames()
+{
+    string names;
+    for (const FormatDef& def : formatDefs) {
+        if (!names.empty())
+            names += ", ";
+        names += def.name;
     }
+    return names;
 }
 
 /*
  * private SoundExporter
  */
 
-size_t SoundExporter::exportSong(const string& fileName, uint16_t uid)
+void SoundExporter::workerThread(vector<ExportJob>& jobs)
+{
+    while (true)
+    {
+        size_t i;
+        {
+            lock_guard<mutex> lock(uilock);
+            if (nextJob >= jobs.size() || workerError)
+                return;
+            i = nextJob++;
+        }
+
+        try {
+            exportSong(jobs[i]);
+        } catch (...) {
+            lock_guard<mutex> lock(uilock);
+            if (!workerError)
+                workerError = current_exception();
+            return;
+        }
+
+        // report finished songs in playlist order, no matter which worker finishes first
+        lock_guard<mutex> lock(uilock);
+        jobs[i].done = true;
+        while (nextReport < jobs.size() && jobs[nextReport].done) {
+            _print_debug("%3d %% - Rendered to file: \"%s\"", int((nextReport + 1) * 100 / jobs.size()), jobs[nextReport].name.c_str());
+            nextReport++;
+        }
+    }
+}
+
+void SoundExporter::exportSong(ExportJob& job)
 {
     // setup our generators
     GameConfig& cfg = ConfigManager::Instance().GetCfg();
-    Sequence seq(sd.sTable->GetPosOfSong(uid), cfg.GetTrackLimit(), rom);
-    StreamGenerator sg(seq, EnginePars(cfg.GetPCMVol(), cfg.GetEngineRev(), cfg.GetEngineFreq()), 2, 1.0f, cfg.GetRevType());
+    // each song works on its own ROM reader so that songs can be rendered concurrently
+    Rom songRom(rom);
+    string cacheKey;
+    if (cache) {
+        const char *modeNames[] = { "mixdown", "tracks", "tracks+mixdown" };
+        string variant = string(modeNames[static_cast<int>(mode)]) + " " + formatDefs[static_cast<int>(format)].name;
+        if (multichannel && mode != ExportMode::MIXDOWN)
+            variant += " multichannel";
+        if (loopExport)
+            variant += " loop";
+        // segmented renders only approximate the reverb at the segment boundaries
+        if (segmentThreads > 1)
+            variant += " segmented";
+        cacheKey = cache->GetKey(songRom, job.songPos, sampleRate, EXPORT_MAX_LOOPS, variant);
+        if (cache->Fetch(cacheKey, job.fileName, job.files)) {
+            job.cached = true;
+            return;
+        }
+    }
+    Sequence seq(job.songPos, cfg.GetTrackLimit(), songRom);
+    StreamGenerator sg(seq, EnginePars(cfg.GetPCMVol(), cfg.GetEngineRev(), cfg.GetEngineFreq()), EXPORT_MAX_LOOPS, 1.0f, cfg.GetRevType(), sampleRate);
+    // songs without a usable loop are still rendered with two loops and a fade out
+    sg.SetStopAtLoop(loopExport);
     size_t blocksRendered = 0;
     size_t nBlocks = sg.GetBufferUnitCount();
     size_t nTracks = seq.tracks.size();
+    auto startTime = chrono::high_resolution_clock::now();
     // libsndfile setup
     if (!benchmarkOnly) 
     {
-        if (seperate)
-        {
-            vector<SNDFILE *> ofiles(nTracks, nullptr);
-            vector<SF_INFO> oinfos(nTracks);
+        // libsndfile only takes the loop points before the audio, so a pass without audio finds them first
+        size_t loopStart = 0, loopEnd = 0;
+        bool hasLoop = false;
+        if (loopExport) {
+            StreamGenerator probe(sg);
+            probe.SetSkipAudio(true);
+            while (!probe.HasStreamEnded())
+                probe.ProcessAndGetAudio();
+            hasLoop = probe.GetLoopPoints(loopStart, loopEnd);
+        }
+        bool loopStored = true;
 
-            for (size_t i = 0; i < nTracks; i++)
-            {
-                memset(&oinfos[i], 0, sizeof(oinfos[i]));
-                oinfos[i].samplerate = STREAM_SAMPLERATE;
-                oinfos[i].channels = N_CHANNELS;
-                oinfos[i].format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
-                char outName[PATH_MAX];
-                snprintf(outName, sizeof(outName), "%s.%02zu.wav", fileName.c_str(), i);
-                ofiles[i] = sf_open(outName, SFM_WRITE, &oinfos[i]);
-                if (ofiles[i] == NULL)
-                    _print_debug("Error: %s", sf_strerror(NULL));
+        // track files come first, the mixdown is the last file
+        bool writeTracks = mode != ExportMode::MIXDOWN;
+        bool writeMixdown = mode != ExportMode::TRACKS;
+        // in multichannel mode all tracks share a single file
+        size_t nTrackFiles = writeTracks ? (multichannel ? min<size_t>(nTracks, 1) : nTracks) : 0;
+        size_t nFiles = nTrackFiles + (writeMixdown ? 1 : 0);
+        size_t mixdownFile = nFiles - 1;
+        const FormatDef& fdef = formatDefs[static_cast<int>(format)];
+        vector<SNDFILE *> ofiles(nFiles, nullptr);
+        bool anyFileOpen = false;
+        for (size_t i = 0; i < ofiles.size(); i++)
+        {
+            SF_INFO oinfo;
+            memset(&oinfo, 0, sizeof(oinfo));
+            oinfo.samplerate = int(sampleRate);
+            oinfo.channels = N_CHANNELS;
+            oinfo.format = fdef.sfFormat;
+            char outName[PATH_MAX];
+            if (writeMixdown && i == mixdownFile) {
+                snprintf(outName, sizeof(outName), "%s.%s", job.fileName.c_str(), fdef.extension);
+            } else if (multichannel) {
+                oinfo.channels = int(nTracks * N_CHANNELS);
+                // RF64 falls back to a plain WAV header for files below 4 GiB
+                if ((oinfo.format & SF_FORMAT_TYPEMASK) == SF_FORMAT_WAV)
+                    oinfo.format = SF_FORMAT_RF64 | (oinfo.format & SF_FORMAT_SUBMASK);
+                snprintf(outName, sizeof(outName), "%s.tracks.%s", job.fileName.c_str(), fdef.extension);
+            } else {
+                snprintf(outName, sizeof(outName), "%s.%02zu.%s", job.fileName.c_str(), i, fdef.extension);
+            }
+            if (!sf_format_check(&oinfo)) {
+                _print_debug("Error: %s with %d channels is not supported by libsndfile", fdef.description, oinfo.channels);
+                lock_guard<mutex> lock(uilock);
+                writeError = true;
+                continue;
+            }
+            ofiles[i] = sf_open(outName, SFM_WRITE, &oinfo);
+            if (ofiles[i] == NULL) {
+                _print_debug("Error: %s", sf_strerror(NULL));
+                lock_guard<mutex> lock(uilock);
+                writeError = true;
+                continue;
+            }
+            anyFileOpen = true;
+            job.files.push_back(outName);
+            // only WAV has a place for loop points, RF64 and the compressed formats don't
+            if (hasLoop) {
+                if ((oinfo.format & SF_FORMAT_TYPEMASK) != SF_FORMAT_WAV)
+                    loopStored = false;
+                else if (!storeLoop(ofiles[i], loopStart, loopEnd))
+                    _print_debug("Error: Storing the loop points failed: %s", sf_strerror(ofiles[i]));
             }
+            // integer formats should clip instead of wrapping around
+            if (fdef.ditherBits > 0)
+                sf_command(ofiles[i], SFC_SET_CLIPPING, NULL, SF_TRUE);
+            if (multichannel && i < nTrackFiles) {
+                if ((oinfo.format & SF_FORMAT_TYPEMASK) == SF_FORMAT_RF64)
+                    sf_command(ofiles[i], SFC_RF64_AUTO_DOWNGRADE, NULL, SF_TRUE);
+                // channel map: each track is a consecutive left/right channel pair
+                string channelMap = "agbplay track channels:";
+                for (size_t trk = 0; trk < nTracks; trk++) {
+                    char pair[64];
+                    snprintf(pair, sizeof(pair), " %zu-%zu=track %02zu", trk * N_CHANNELS + 1, trk * N_CHANNELS + N_CHANNELS, trk);
+                    channelMap += pair;
+                }
+                sf_set_string(ofiles[i], SF_STR_COMMENT, channelMap.c_str());
+            }
+        }
+        if (!anyFileOpen)
+            return;
+        if (!loopStored)
+            _print_debug("Warning: Loop points of \"%s\" are only stored in WAV files, not RF64 or %s", job.name.c_str(), fdef.description);
 
-            while (true)
-            {
-                vector<vector<float>>& rbuffers = sg.ProcessAndGetAudio();
-                if (sg.HasStreamEnded())
-                    break;
+        // rendering continues while the writer thread encodes and writes the previous chunks
+        SoundFileWriter writer(ofiles, EXPORT_CHUNK_SIZE, EXPORT_QUEUE_CHUNKS, fdef.ditherBits);
+        vector<float> interleavedData;
+        // the output stage of the generator sums the tracks, they are only needed for track files
+        sg.SetStemOutput(writeTracks);
 
+        auto writeAudio = [&](vector<vector<float>>& rbuffers, vector<float>& mixdown, size_t blocks) {
+            if (writeTracks && multichannel)
+            {
                 assert(rbuffers.size() == nTracks);
-
-                for (size_t i = 0; i < nTracks; i++) 
+                // interleave all tracks into a single sequential stream
+                interleavedData.resize(blocks * N_CHANNELS * nTracks);
+                float *out = interleavedData.data();
+                for (size_t i = 0; i < blocks; i++)
                 {
-                    // do not write to invalid files
-                    if (ofiles[i] == NULL)
-                        continue;
-                    sf_count_t processed = 0;
-                    do {
-                        processed += sf_write_float(ofiles[i], rbuffers[i].data() + processed, sf_count_t(nBlocks * N_CHANNELS) - processed);
-                    } while (processed < sf_count_t(nBlocks * N_CHANNELS));
+                    for (size_t t = 0; t < nTracks; t++)
+                    {
+                        *out++ = rbuffers[t][i * N_CHANNELS];
+                        *out++ = rbuffers[t][i * N_CHANNELS + 1];
+                    }
                 }
-                blocksRendered += nBlocks;
+                if (nTrackFiles > 0)
+                    writer.Write(0, interleavedData.data(), interleavedData.size());
             }
-
-            for (SNDFILE *& i : ofiles)
+            else if (writeTracks)
+            {
+                assert(rbuffers.size() == nTracks);
+                for (size_t i = 0; i < nTracks; i++)
+                    writer.Write(i, rbuffers[i].data(), blocks * N_CHANNELS);
+            }
+            if (writeMixdown)
             {
-                int err = sf_close(i);
-                if (err != 0)
-                    _print_debug("Error: %s", sf_error_number(err));
+                assert(mixdown.size() >= blocks * N_CHANNELS);
+                writer.Write(mixdownFile, mixdown.data(), blocks * N_CHANNELS);
             }
+        };
+
+        if (segmentThreads > 1)
+        {
+            // spare threads render parts of the song concurrently
+            SegmentRenderer sr(sg, segmentThreads, writeTracks, writeMixdown);
+            blocksRendered = sr.Render(writeAudio);
         }
         else
         {
-            SF_INFO oinfo;
-            memset(&oinfo, 0, sizeof(oinfo));
-            oinfo.samplerate = STREAM_SAMPLERATE;
-            oinfo.channels = N_CHANNELS;
-            oinfo.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
-            SNDFILE *ofile = sf_open((fileName + ".wav").c_str(), SFM_WRITE, &oinfo);
-            if (ofile == NULL) {
-                _print_debug("Error: %s", sf_strerror(NULL));
-                return 0;
-            }
-            // do rendering and write
-            vector<float> renderedData(nBlocks * N_CHANNELS);
-
-            while (true) 
+            while (true)
             {
-                vector<vector<float>>& rbuffers = sg.ProcessAndGetAudio();
+                size_t frames = sg.ProcessFrames(RENDER_QUANTUM_FRAMES);
+                if (frames > 0)
+                    writeAudio(sg.GetTrackAudio(), sg.GetMasterAudio(), frames * nBlocks);
+                blocksRendered += frames * nBlocks;
                 if (sg.HasStreamEnded())
                     break;
-                // mix streams to one master
-                assert(rbuffers.size() == nTracks);
-                // clear mixing buffer
-                fill(renderedData.begin(), renderedData.end(), 0.0f);
-                // mix all tracks to buffer
-                for (vector<float>& b : rbuffers)
-                {
-                    assert(b.size() == renderedData.size());
-                    for (size_t i = 0; i < b.size(); i++)
-                        renderedData[i] += b[i];
-                }
-                sf_count_t processed = 0;
-                do {
-                    processed += sf_write_float(ofile, renderedData.data() + processed, sf_count_t(nBlocks * N_CHANNELS) - processed);
-                } while (processed < sf_count_t(nBlocks * N_CHANNELS));
-                blocksRendered += nBlocks;
             }
+        }
 
-            int err;
-            if ((err = sf_close(ofile)) != 0)
-                _print_debug("Error: %s", sf_error_number(err));
+        job.renderTime = chrono::duration<double>(chrono::high_resolution_clock::now() - startTime).count();
+        bool success = writer.Finish();
+        // waiting for the writer doesn't count as rendering
+        job.renderTime -= writer.GetStallTime();
+        job.writeTime = writer.GetWriteTime();
+        job.samplesWritten = writer.GetSamplesWritten();
+        if (!success) {
+            lock_guard<mutex> lock(uilock);
+            writeError = true;
+        } else if (cache && job.files.size() == nFiles) {
+            cache->Store(cacheKey, job.fileName, job.files);
         }
     } 
+    // compare the segmented render to a serial one
+    else if (verifySegments) {
+        blocksRendered = verifySong(job, sg);
+        job.renderTime = chrono::duration<double>(chrono::high_resolution_clock::now() - startTime).count();
+    }
     // if benchmark only
     else {
+        sg.SetProfiling(true);
         while (true)
         {
-            sg.ProcessAndGetAudio();
-            blocksRendered += nBlocks;
+            blocksRendered += sg.ProcessFrames(RENDER_QUANTUM_FRAMES) * nBlocks;
             if (sg.HasStreamEnded())
                 break;
         }
+        job.renderTime = chrono::duration<double>(chrono::high_resolution_clock::now() - startTime).count();
+        job.profile = sg.GetProfile();
+    }
+    job.blocksRendered = blocksRendered;
+}
+
+size_t SoundExporter::verifySong(ExportJob& job, StreamGenerator& sg)
+{
+    // the serial reference starts from the same state as the segmented render
+    StreamGenerator serial(sg);
+    size_t nBlocks = sg.GetBufferUnitCount();
+    size_t nTracks = sg.GetWorkingSequence().tracks.size();
+    size_t blocksCompared = 0;
+    size_t buffersDiffering = 0;
+    size_t maxDiffBlock = 0;
+    float maxDiff = 0.0f;
+    double squareSum = 0.0;
+    bool lengthMismatch = false;
+
+    SegmentRenderer sr(sg, segmentThreads, true, false);
+    size_t blocksRendered = sr.Render([&](vector<vector<float>>& buffers, vector<float>&, size_t blocks) {
+        for (size_t offset = 0; offset < blocks && !lengthMismatch; offset += nBlocks)
+        {
+            vector<vector<float>>& rbuffers = serial.ProcessAndGetAudio();
+            if (serial.HasStreamEnded()) {
+                lengthMismatch = true;
+                break;
+            }
+            bool differs = false;
+            for (size_t t = 0; t < nTracks; t++)
+            {
+                const float *segmented = &buffers[t][offset * N_CHANNELS];
+                for (size_t i = 0; i < nBlocks * N_CHANNELS; i++)
+                {
+                    float diff = fabsf(segmented[i] - rbuffers[t][i]);
+                    if (diff == 0.0f)
+                        continue;
+                    differs = true;
+                    squareSum += double(diff) * double(diff);
+                    if (diff > maxDiff) {
+                        maxDiff = diff;
+                        maxDiffBlock = blocksCompared + offset + i / N_CHANNELS;
+                    }
+                }
+            }
+            if (differs)
+                buffersDiffering++;
+        }
+        blocksCompared += blocks;
+    });
+    // the serial render has to end right after the last segment
+    if (!lengthMismatch) {
+        serial.ProcessAndGetAudio();
+        lengthMismatch = !serial.HasStreamEnded();
+    }
+
+    if (lengthMismatch) {
+        _print_debug("Error: Segmented render of \"%s\" doesn't have the length of the serial render", job.name.c_str());
+        lock_guard<mutex> lock(uilock);
+        writeError = true;
+    } else if (maxDiff == 0.0f) {
+        _print_debug("Verified \"%s\": identical to the serial render", job.name.c_str());
+    } else {
+        double rms = sqrt(squareSum / double(max<size_t>(blocksCompared * N_CHANNELS * nTracks, 1)));
+        _print_debug("Verified \"%s\": %zu of %zu buffers differ, max difference %.1f dB at %.2f s, RMS difference %.1f dB",
+                job.name.c_str(), buffersDiffering, blocksCompared / nBlocks,
+                20.0 * log10(double(maxDiff)), double(maxDiffBlock) / double(sg.GetRenderSampleRate()),
+                20.0 * log10(rms));
     }
     return blocksRendered;
 }
+
+void SoundExporter::writeManifest(const string& outputDir, vector<ExportJob>& jobs,
+        vector<ExportJob>& duplicates, vector<size_t>& originals, vector<ExportJob>& emptySongs)
+{
+    namespace fs = boost::filesystem;
+    // duplicates link to the files of the song they are identical to
+    for (size_t i = 0; i < duplicates.size(); i++) {
+        ExportJob& original = jobs[originals[i]];
+        for (const string& file : original.files) {
+            // keep the suffix (track number and extension) of the original file
+            string link = duplicates[i].fileName + file.substr(original.fileName.size());
+            boost::system::error_code ec;
+            // replace links from earlier exports
+            fs::remove(link, ec);
+            fs::create_symlink(fs::path(file).filename(), link, ec);
+            if (ec)
+                _print_debug("Warning: Couldn't link \"%s\": %s", link.c_str(), ec.message().c_str());
+        }
+    }
+
+    string manifestName = outputDir + "/manifest.txt";
+    ofstream manifest(manifestName);
+    manifest << "# song\tstatus\tname" << endl;
+    for (ExportJob& job : jobs)
+        manifest << job.uid << "\trendered\t" << job.name << endl;
+    for (size_t i = 0; i < duplicates.size(); i++)
+        manifest << duplicates[i].uid << "\tduplicate of " << jobs[originals[i]].uid << "\t" << duplicates[i].name << endl;
+    for (ExportJob& job : emptySongs)
+        manifest << job.uid << "\tempty\t" << job.name << endl;
+    if (!manifest) {
+        _print_debug("Error: Couldn't write %s", manifestName.c_str());
+        writeError = true;
+    }
+}
+
+static string jsonString(const string& str)
+{
+    string result = "\"";
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        } else if (uint8_t(c) < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            result += esc;
+        } else {
+            result += c;
+        }
+    }
+    return result + "\"";
+}
+
+static void writeProfile(ostream& os, double audioTime, double renderTime, const RenderProfile& p, const char *indent)
+{
+    os << indent << "\"audioSeconds\": " << audioTime << "," << endl;
+    os << indent << "\"wallSeconds\": " << renderTime << "," << endl;
+    os << indent << "\"realtimeFactor\": " << (renderTime > 0.0 ? audioTime / renderTime : 0.0) << "," << endl;
+    os << indent << "\"sequencerSeconds\": " << p.sequencer << "," << endl;
+    os << indent << "\"pcmSeconds\": " << p.pcm << "," << endl;
+    os << indent << "\"cgbSeconds\": " << p.cgb << "," << endl;
+    os << indent << "\"reverbSeconds\": " << p.reverb << "," << endl;
+    os << indent << "\"mixingSeconds\": " << p.mixing << "," << endl;
+    os << indent << "\"peakActiveChannels\": " << p.peakChannels << endl;
+}
+
+void SoundExporter::writeReport(const string& reportFile, vector<ExportJob>& jobs, double wallTime)
+{
+    ofstream report(reportFile);
+    report << setprecision(6) << fixed;
+    report << "{" << endl;
+    report << "    \"sampleRate\": " << sampleRate << "," << endl;
+    report << "    \"threads\": " << min(threads, jobs.size()) << "," << endl;
+    report << "    \"instructionSet\": " << jsonString(MixKernels::GetInstructionSet()) << "," << endl;
+    report << "    \"kernelError\": " << setprecision(9) << kernelError << setprecision(6) << "," << endl;
+    SampleCache& sc = SampleCache::Instance();
+    report << "    \"sampleCache\": {" << endl;
+    report << "        \"samples\": " << sc.GetSampleCount() << "," << endl;
+    report << "        \"bytes\": " << sc.GetMemoryUsage() << "," << endl;
+    report << "        \"hitRate\": " << sc.GetHitRate() << endl;
+    report << "    }," << endl;
+    report << "    \"songs\": [" << endl;
+    RenderProfile total;
+    double totalAudio = 0.0;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        ExportJob& job = jobs[i];
+        double audioTime = double(job.blocksRendered) / sampleRate;
+        report << "        {" << endl;
+        report << "            \"uid\": " << job.uid << "," << endl;
+        report << "            \"name\": " << jsonString(job.name) << "," << endl;
+        writeProfile(report, audioTime, job.renderTime, job.profile, "            ");
+        report << "        }" << (i + 1 < jobs.size() ? "," : "") << endl;
+
+        totalAudio += audioTime;
+        total.sequencer += job.profile.sequencer;
+        total.pcm += job.profile.pcm;
+        total.cgb += job.profile.cgb;
+        total.reverb += job.profile.reverb;
+        total.mixing += job.profile.mixing;
+        total.peakChannels = max(total.peakChannels, job.profile.peakChannels);
+    }
+    report << "    ]," << endl;
+    // the total wall time is shorter than the sum of all songs if songs are rendered in parallel
+    report << "    \"total\": {" << endl;
+    report << "        \"songs\": " << jobs.size() << "," << endl;
+    writeProfile(report, totalAudio, wallTime, total, "        ");
+    report << "    }" << endl;
+    report << "}" << endl;
+    if (!report) {
+        _print_debug("Error: Couldn't write benchmark report %s", reportFile.c_str());
+        writeError = true;
+    } else {
+        _print_debug("Wrote benchmark report to %s", reportFile.c_str());
+    }
+}
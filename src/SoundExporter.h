@@ -4,30 +4,108 @@
 #include <vector>
 #include <cstdint>
 #include <mutex>
+#include <exception>
+#include <thread>
 
 #include "StreamGenerator.h"
 #include "SongEntry.h"
 #include "GameConfig.h"
-#include "ConsoleGUI.h"
+#include "RenderCache.h"
+
+// songs are exported with two loops and a fade out, the player streams cached exports up to the fade
+#define EXPORT_MAX_LOOPS 2
 
 namespace agbplay
 {
+    // TRACKS_AND_MIXDOWN renders the song only once for both outputs
+    enum class ExportMode { MIXDOWN, TRACKS, TRACKS_AND_MIXDOWN };
+    enum class ExportFormat : int { WAV_FLOAT = 0, WAV_PCM16, WAV_PCM24, FLAC16, FLAC24, OGG_VORBIS, OGG_OPUS };
+
     class SoundExporter
     {
         public:
-            SoundExporter(ConsoleGUI& _con, SoundData& _sd, Rom& _rom, bool _benchmarkOnly, bool seperate);
+            // threads = 0 uses one worker per hardware thread
+            SoundExporter(SoundData& _sd, Rom& _rom, bool _benchmarkOnly, ExportMode mode, size_t threads = 0);
             ~SoundExporter();
 
-            void Export(const std::string& outputDir, std::vector<SongEntry>& entries, std::vector<bool>& ticked);
+            // returns false if any of the output files couldn't be written or a segment verification failed
+            bool Export(const std::string& outputDir, std::vector<SongEntry>& entries, std::vector<bool>& ticked);
+            // write all track stems to one multichannel file instead of one file per track
+            void SetMultichannel(bool multichannel);
+            // render the intro and one loop only and store the loop points in the files
+            void SetLoopExport(bool loopExport);
+            // skip empty songs and render songs with identical data only once,
+            // duplicates get symlinks and are listed in a manifest
+            void SetDeduplicate(bool deduplicate);
+            // JSON benchmark report, defaults to benchmark.json in the output directory
+            void SetReportFile(const std::string& reportFile);
+            // songs rendered earlier with the same data and settings are taken from the cache,
+            // defaults to RENDER_CACHE of the game config, empty disables the cache
+            void SetRenderCache(const std::string& cacheDir);
+            // output sample rate, the config or STREAM_SAMPLERATE by default
+            void SetSampleRate(uint32_t sampleRate);
+            // threads that aren't needed for separate songs render the songs in segments, which only
+            // approximates the reverb at the segment starts, so it's off by default
+            void SetSegmented(bool segmented);
+            // benchmark mode only: render each song in segments and compare it to a serial render
+            void SetVerifySegments(bool verifySegments);
+            void SetFormat(ExportFormat format);
+            // parses format names like "wav", "flac" or "opus", returns false for unknown names
+            static bool ParseFormat(const std::string& name, ExportFormat& format);
+            static std::string FormatNames();
         private:
-            size_t exportSong(const std::string& fileName, uint16_t uid);
+            struct ExportJob
+            {
+                uint16_t uid;
+                std::string name;
+                std::string fileName;
+                // output files, set when the song has been rendered
+                std::vector<std::string> files;
+                long songPos;
+                size_t blocksRendered;
+                double renderTime;
+                double writeTime;
+                size_t samplesWritten;
+                RenderProfile profile;
+                bool cached;
+                bool done;
+            };
+
+            void workerThread(std::vector<ExportJob>& jobs);
+            void exportSong(ExportJob& job);
+            size_t verifySong(ExportJob& job, StreamGenerator& sg);
+            void writeManifest(const std::string& outputDir, std::vector<ExportJob>& jobs,
+                    std::vector<ExportJob>& duplicates, std::vector<size_t>& originals,
+                    std::vector<ExportJob>& emptySongs);
+            void writeReport(const std::string& reportFile, std::vector<ExportJob>& jobs, double wallTime);
 
-            ConsoleGUI& con;
             SoundData& sd;
             Rom& rom;
             std::mutex uilock;
 
+            // worker state, guarded by uilock
+            size_t nextJob;
+            size_t nextReport;
+            std::exception_ptr workerError;
+            bool writeError;
+
             bool benchmarkOnly;
-            bool seperate; // seperate tracks to multiple files
+            ExportMode mode;
+            bool multichannel;
+            bool loopExport;
+            bool deduplicate;
+            std::string reportFile;
+            std::string cacheDir;
+            // only set while exporting
+            RenderCache *cache;
+            ExportFormat format;
+            uint32_t sampleRate;
+            size_t threads;
+            bool segmented;
+            // threads used for the segments of each song, set by Export
+            size_t segmentThreads;
+            bool verifySegments;
+            // largest deviation of the mixing kernels from the scalar reference, benchmark only
+            float kernelError;
     };
 }
@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <chrono>
+
+#include "SoundFileWriter.h"
+#include "Debug.h"
+
+using namespace std;
+using namespace agbplay;
+
+/*
+ * public SoundFileWriter
+ */
+
+SoundFileWriter::SoundFileWriter(const vector<SNDFILE *>& files, size_t chunkSize, size_t maxChunks, unsigned ditherBits)
+    : files(files), pending(files.size())
+{
+    this->chunkSize = chunkSize;
+    this->maxChunks = maxChunks;
+    // one LSB of the output format, libsndfile scales floats by 2^(bits-1)
+    ditherAmplitude = ditherBits > 0 ? 1.0f / float(1u << (ditherBits - 1)) : 0.0f;
+    ditherState = 0x12345678;
+    samplesWritten = 0;
+    finishing = false;
+    finished = false;
+    error = false;
+    writeTime = 0.0;
+    stallTime = 0.0;
+    for (vector<float>& p : pending)
+        p.reserve(chunkSize);
+    writerThread = thread(&SoundFileWriter::ioThread, this);
+#ifdef __linux__
+    pthread_setname_np(writerThread.native_handle(), "export writer");
+#endif
+}
+
+SoundFileWriter::~SoundFileWriter()
+{
+    if (!finished)
+        Finish();
+}
+
+void SoundFileWriter::Write(size_t file, const float *data, size_t nElements)
+{
+    // do not write to invalid files
+    if (files[file] == nullptr)
+        return;
+    vector<float>& p = pending[file];
+    while (nElements > 0) {
+        size_t count = min(nElements, chunkSize - p.size());
+        p.insert(p.end(), data, data + count);
+        data += count;
+        nElements -= count;
+        if (p.size() >= chunkSize)
+            pushChunk(file);
+    }
+}
+
+bool SoundFileWriter::Finish()
+{
+    for (size_t i = 0; i < pending.size(); i++) {
+        if (!pending[i].empty())
+            pushChunk(i);
+    }
+    {
+        unique_lock<mutex> lock(queueLock);
+        finishing = true;
+    }
+    sig.notify_all();
+    writerThread.join();
+
+    auto startTime = chrono::high_resolution_clock::now();
+    for (SNDFILE *f : files) {
+        if (f == nullptr)
+            continue;
+        int err = sf_close(f);
+        if (err != 0) {
+            _print_debug("Error: %s", sf_error_number(err));
+            error = true;
+        }
+    }
+    writeTime += chrono::duration<double>(chrono::high_resolution_clock::now() - startTime).count();
+    finished = true;
+    return !error;
+}
+
+double SoundFileWriter::GetWriteTime()
+{
+    return writeTime;
+}
+
+double SoundFileWriter::GetStallTime()
+{
+    return stallTime;
+}
+
+size_t SoundFileWriter::GetSamplesWritten()
+{
+    return samplesWritten;
+}
+
+/*
+ * private SoundFileWriter
+ */
+
+void SoundFileWriter::pushChunk(size_t file)
+{
+    unique_lock<mutex> lock(queueLock);
+    if (queue.size() >= maxChunks) {
+        auto startTime = chrono::high_resolution_clock::now();
+        while (queue.size() >= maxChunks)
+            sig.wait(lock);
+        stallTime += chrono::duration<double>(chrono::high_resolution_clock::now() - startTime).count();
+    }
+    queue.push_back({file, move(pending[file])});
+    // recycle buffers that have been written already
+    if (!freeChunks.empty()) {
+        pending[file] = move(freeChunks.back());
+        freeChunks.pop_back();
+    } else {
+        pending[file] = vector<float>();
+        pending[file].reserve(chunkSize);
+    }
+    lock.unlock();
+    sig.notify_all();
+}
+
+void SoundFileWriter::ioThread()
+{
+    unique_lock<mutex> lock(queueLock);
+    while (true) {
+        while (queue.empty() && !finishing)
+            sig.wait(lock);
+        if (queue.empty())
+            break;
+        Chunk c = move(queue.front());
+        queue.pop_front();
+        lock.unlock();
+        sig.notify_all();
+
+        auto startTime = chrono::high_resolution_clock::now();
+        if (ditherAmplitude > 0.0f)
+            dither(c.data);
+        SNDFILE *f = files[c.file];
+        sf_count_t processed = 0;
+        sf_count_t total = sf_count_t(c.data.size());
+        while (processed < total) {
+            sf_count_t written = sf_write_float(f, c.data.data() + processed, total - processed);
+            if (written <= 0) {
+                _print_debug("Error: %s", sf_strerror(f));
+                break;
+            }
+            processed += written;
+        }
+        double t = chrono::duration<double>(chrono::high_resolution_clock::now() - startTime).count();
+
+        lock.lock();
+        writeTime += t;
+        samplesWritten += size_t(processed);
+        if (processed < total)
+            error = true;
+        c.data.clear();
+        freeChunks.push_back(move(c.data));
+    }
+}
+
+void SoundFileWriter::dither(vector<float>& data)
+{
+    // triangular PDF dither: sum of two uniform random values, +-1 LSB peak
+    uint32_t x = ditherState;
+    for (float& samp : data) {
+        x = x * 1664525u + 1013904223u;
+        float r1 = float(x >> 8) * (1.0f / 16777216.0f);
+        x = x * 1664525u + 1013904223u;
+        float r2 = float(x >> 8) * (1.0f / 16777216.0f);
+        samp += (r1 - r2) * ditherAmplitude;
+    }
+    ditherState = x;
+}
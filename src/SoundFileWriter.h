@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstddef>
+#include <cstdint>
+#include <sndfile.h>
+
+namespace agbplay
+{
+    /*
+     * Writes interleaved float audio to one or more sound files on a
+     * dedicated I/O thread. Samples are collected into large chunks which
+     * are passed to the I/O thread through a bounded queue, so the render
+     * thread only waits if the disk can't keep up. Encoding (and dithering
+     * for integer formats) happens on the I/O thread as well.
+     */
+    class SoundFileWriter
+    {
+        public:
+            // ditherBits > 0 adds TPDF dither for an integer output of that bit depth
+            SoundFileWriter(const std::vector<SNDFILE *>& files, size_t chunkSize, size_t maxChunks, unsigned ditherBits = 0);
+            ~SoundFileWriter();
+
+            void Write(size_t file, const float *data, size_t nElements);
+            // flushes all remaining data and closes the files, returns false on write errors
+            bool Finish();
+            // seconds spent in libsndfile on the I/O thread
+            double GetWriteTime();
+            // seconds the writing thread had to wait for a free queue slot
+            double GetStallTime();
+            size_t GetSamplesWritten();
+        private:
+            struct Chunk
+            {
+                size_t file;
+                std::vector<float> data;
+            };
+
+            void pushChunk(size_t file);
+            void ioThread();
+            void dither(std::vector<float>& data);
+
+            std::vector<SNDFILE *> files;
+            std::vector<std::vector<float>> pending;
+            std::deque<Chunk> queue;
+            std::vector<std::vector<float>> freeChunks;
+            std::mutex queueLock;
+            std::condition_variable sig;
+            std::thread writerThread;
+
+            size_t chunkSize;
+            size_t maxChunks;
+            float ditherAmplitude;
+            uint32_t ditherState;
+            size_t samplesWritten;
+            bool finishing;
+            bool finished;
+            bool error;
+            double writeTime;
+            double stallTime;
+    };
+}
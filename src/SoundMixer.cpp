@@ -1,12 +1,15 @@
 #include <algorithm>
 #include <cmath>
 #include <cassert>
+#include <chrono>
+#include <initializer_list>
 
 #include "SoundMixer.h"
 #include "Xcept.h"
 #include "Debug.h"
 #include "Util.h"
 #include "ConfigManager.h"
+#include "MixKernels.h"
 
 using namespace std;
 using namespace agbplay;
@@ -16,32 +19,35 @@ using namespace agbplay;
  */
 
 SoundMixer::SoundMixer(uint32_t sampleRate, uint32_t fixedModeRate, uint8_t reverb, float mvl, ReverbType rtype, uint8_t ntracks)
-    : sq1(), sq2(), wave(), noise()
+    : sq1(), sq2(), wave(), noise(), masterLoudness(MASTER_METER_FREQ, sampleRate)
 {
     GameConfig& gameCfg = ConfigManager::Instance().GetCfg();
     samplesPerBuffer = (size_t)round(sampleRate / (AGB_FPS * INTERFRAMES));
+    engineRateMix = gameCfg.GetEngineRateMix();
+    // the reverb works on the PCM audio, so it runs on the bus in engine rate mode
+    uint32_t revRate = engineRateMix ? fixedModeRate : sampleRate;
     for (size_t i = 0; i < ntracks; i++)
     {
         switch (rtype) {
             case ReverbType::NORMAL:
-                revdsps.push_back(new ReverbEffect(reverb, sampleRate, uint8_t(gameCfg.GetRevBufSize() / (fixedModeRate / AGB_FPS))));
+                revdsps.push_back(new ReverbEffect(reverb, revRate, uint8_t(gameCfg.GetRevBufSize() / (fixedModeRate / AGB_FPS))));
                 break;
             case ReverbType::NONE:
-                revdsps.push_back(new ReverbEffect(0, sampleRate, uint8_t(gameCfg.GetRevBufSize() / (fixedModeRate / AGB_FPS))));
+                revdsps.push_back(new ReverbEffect(0, revRate, uint8_t(gameCfg.GetRevBufSize() / (fixedModeRate / AGB_FPS))));
                 break;
             case ReverbType::GS1:
-                revdsps.push_back(new ReverbGS1(reverb, sampleRate, uint8_t(gameCfg.GetRevBufSize() / (fixedModeRate / AGB_FPS))));
+                revdsps.push_back(new ReverbGS1(reverb, revRate, uint8_t(gameCfg.GetRevBufSize() / (fixedModeRate / AGB_FPS))));
                 break;
             case ReverbType::GS2:
-                revdsps.push_back(new ReverbGS2(reverb, sampleRate, uint8_t(gameCfg.GetRevBufSize() / (fixedModeRate / AGB_FPS)),
+                revdsps.push_back(new ReverbGS2(reverb, revRate, uint8_t(gameCfg.GetRevBufSize() / (fixedModeRate / AGB_FPS)),
                         0.4140625f, -0.0625f));
                 break;
             case ReverbType::MGAT:
-                revdsps.push_back(new ReverbGS2(reverb, sampleRate, uint8_t(gameCfg.GetRevBufSize() / (fixedModeRate / AGB_FPS)),
+                revdsps.push_back(new ReverbGS2(reverb, revRate, uint8_t(gameCfg.GetRevBufSize() / (fixedModeRate / AGB_FPS)),
                         0.25f, -0.046875f));
                 break;
             case ReverbType::TEST:
-                revdsps.push_back(new ReverbTest(reverb, sampleRate, uint8_t(gameCfg.GetRevBufSize() / (fixedModeRate / AGB_FPS))));
+                revdsps.push_back(new ReverbTest(reverb, revRate, uint8_t(gameCfg.GetRevBufSize() / (fixedModeRate / AGB_FPS))));
                 break;
             default:
                 throw Xcept("Invalid Reverb Effect");
@@ -49,6 +55,38 @@ SoundMixer::SoundMixer(uint32_t sampleRate, uint32_t fixedModeRate, uint8_t reve
         soundBuffers.emplace_back(N_CHANNELS * samplesPerBuffer);
         fill(soundBuffers[i].begin(), soundBuffers[i].end(), 0.0f);
     }
+    masterBuffer.resize(N_CHANNELS * samplesPerBuffer, 0.0f);
+    mutedTracks.resize(ntracks, false);
+    renderMuted.resize(ntracks, false);
+    trackLoudness.resize(ntracks, LoudnessCalculator(TRACK_METER_FREQ, sampleRate));
+    stemOutput = true;
+    metering = false;
+    busBlocks = 0;
+    pcmOnMaster = false;
+    if (engineRateMix) {
+        busBlocks = (size_t)round(fixedModeRate / (AGB_FPS * INTERFRAMES));
+        busBuffers.resize(ntracks, vector<float>(N_CHANNELS * busBlocks, 0.0f));
+        busMaster.resize(N_CHANNELS * busBlocks, 0.0f);
+        pcmMaster.resize(N_CHANNELS * samplesPerBuffer, 0.0f);
+        trackConverters.resize(ntracks, RateConverter(busBlocks, samplesPerBuffer));
+        masterConverter = RateConverter(busBlocks, samplesPerBuffer);
+        // the latency is always shorter than a frame
+        assert(masterConverter.GetLatency() < samplesPerBuffer);
+        cgbTracks.resize(ntracks, vector<float>(N_CHANNELS * samplesPerBuffer, 0.0f));
+        cgbDelays.resize(ntracks, vector<float>(N_CHANNELS * masterConverter.GetLatency(), 0.0f));
+    }
+    recordedFrames = 0;
+    cgbBuffers.resize(4);
+    cgbOwners.resize(4);
+    sndChannels.resize(SOUND_CHANNEL_POOL_SIZE);
+    activeChannels.reserve(SOUND_CHANNEL_POOL_SIZE);
+    trackChannels.resize(ntracks);
+    pcmVoiceLimit = gameCfg.GetPCMVoiceLimit();
+    for (vector<size_t>& tc : trackChannels)
+        tc.reserve(SOUND_CHANNEL_POOL_SIZE);
+    // hand out the lowest voices first
+    for (size_t i = SOUND_CHANNEL_POOL_SIZE; i-- > 0;)
+        freeChannels.push_back(i);
     activeBackBuffer.reset();
     this->sampleRate = sampleRate;
     this->fixedModeRate = fixedModeRate;
@@ -59,6 +97,35 @@ SoundMixer::SoundMixer(uint32_t sampleRate, uint32_t fixedModeRate, uint8_t reve
     fadePos = 1.0f;
     fadeStepPerMicroframe = 0.0f;
     this->ntracks = ntracks;
+    profiling = false;
+    skipAudio = false;
+}
+
+SoundMixer::SoundMixer(const SoundMixer& other)
+    : activeBackBuffer(other.activeBackBuffer), sndChannels(other.sndChannels),
+    activeChannels(other.activeChannels), freeChannels(other.freeChannels),
+    trackChannels(other.trackChannels), pcmVoiceLimit(other.pcmVoiceLimit),
+    sq1(other.sq1), sq2(other.sq2), wave(other.wave), noise(other.noise),
+    soundBuffers(other.soundBuffers), masterBuffer(other.masterBuffer),
+    mutedTracks(other.mutedTracks), renderMuted(other.renderMuted), trackLoudness(other.trackLoudness),
+    masterLoudness(other.masterLoudness), stemOutput(other.stemOutput),
+    metering(other.metering), engineRateMix(other.engineRateMix), busBlocks(other.busBlocks),
+    busBuffers(other.busBuffers), busMaster(other.busMaster), pcmMaster(other.pcmMaster),
+    trackConverters(other.trackConverters), masterConverter(other.masterConverter),
+    pcmOnMaster(other.pcmOnMaster), cgbTracks(other.cgbTracks), cgbDelays(other.cgbDelays),
+    recordedFrames(other.recordedFrames),
+    frameGains(other.frameGains), cgbBuffers(other.cgbBuffers), cgbOwners(other.cgbOwners),
+    renderScratch(other.renderScratch),
+    sampleRate(other.sampleRate),
+    fixedModeRate(other.fixedModeRate), samplesPerBuffer(other.samplesPerBuffer),
+    sampleRateReciprocal(other.sampleRateReciprocal), masterVolume(other.masterVolume),
+    pcmMasterVolume(other.pcmMasterVolume), fadePos(other.fadePos),
+    fadeStepPerMicroframe(other.fadeStepPerMicroframe),
+    fadeMicroframesLeft(other.fadeMicroframesLeft), ntracks(other.ntracks),
+    profiling(other.profiling), profile(other.profile), skipAudio(other.skipAudio)
+{
+    for (ReverbEffect *rev : other.revdsps)
+        revdsps.push_back(rev->Clone());
 }
 
 SoundMixer::~SoundMixer()
@@ -70,9 +137,24 @@ SoundMixer::~SoundMixer()
     }
 }
 
-void SoundMixer::NewSoundChannel(uint8_t owner, SampleInfo sInfo, ADSR env, Note note, uint8_t vol, int8_t pan, int16_t pitch, bool fixed)
+void SoundMixer::NewSoundChannel(uint8_t owner, SampleInfo sInfo, ADSR env, Note note, uint8_t vol, int8_t pan, int16_t pitch, bool fixed, uint8_t prio)
 {
-    sndChannels.emplace_back(owner, sInfo, env, note, vol, pan, pitch, fixed);
+    if (pcmVoiceLimit > 0 && !freeVoiceFor(owner, prio))
+        return;
+    if (freeChannels.empty()) {
+        size_t poolSize = sndChannels.size();
+        sndChannels.resize(poolSize * 2);
+        activeChannels.reserve(sndChannels.size());
+        freeChannels.reserve(sndChannels.size());
+        for (size_t i = sndChannels.size(); i-- > poolSize;)
+            freeChannels.push_back(i);
+    }
+    size_t i = freeChannels.back();
+    freeChannels.pop_back();
+    sndChannels[i].Init(owner, sInfo, env, note, vol, pan, pitch, fixed, prio);
+    activeChannels.push_back(i);
+    assert(owner < trackChannels.size());
+    trackChannels[owner].push_back(i);
 }
 
 void SoundMixer::NewCGBNote(uint8_t owner, CGBDef def, ADSR env, Note note, uint8_t vol, int8_t pan, int16_t pitch, CGBType type)
@@ -102,11 +184,11 @@ void SoundMixer::NewCGBNote(uint8_t owner, CGBDef def, ADSR env, Note note, uint
 
 void SoundMixer::SetTrackPV(uint8_t owner, uint8_t vol, int8_t pan, int16_t pitch)
 {
-    for (SoundChannel& sc : sndChannels) {
-        if (sc.GetOwner() == owner) {
-            sc.SetVol(vol, pan);
-            sc.SetPitch(pitch);
-        }
+    assert(owner < trackChannels.size());
+    for (size_t i : trackChannels[owner]) {
+        SoundChannel& sc = sndChannels[i];
+        sc.SetVol(vol, pan);
+        sc.SetPitch(pitch);
     }
     if (sq1.GetOwner() == owner) {
         sq1.SetVol(vol, pan);
@@ -130,13 +212,13 @@ int SoundMixer::TickTrackNotes(uint8_t owner, bitset<NUM_NOTES>& activeNotes)
 {
     activeBackBuffer.reset();
     int active = 0;
-    for (SoundChannel& chn : sndChannels) 
+    assert(owner < trackChannels.size());
+    for (size_t i : trackChannels[owner]) 
     {
-        if (chn.GetOwner() == owner) {
-            if (chn.TickNote()) {
-                active++;
-                activeBackBuffer[chn.GetMidiKey() & 0x7F] = true;
-            }
+        SoundChannel& chn = sndChannels[i];
+        if (chn.TickNote()) {
+            active++;
+            activeBackBuffer[chn.GetMidiKey() & 0x7F] = true;
         }
     }
     if (sq1.GetOwner() == owner && sq1.TickNote()) {
@@ -163,12 +245,13 @@ int SoundMixer::TickTrackNotes(uint8_t owner, bitset<NUM_NOTES>& activeNotes)
 
 void SoundMixer::StopChannel(uint8_t owner, uint8_t key)
 {
-    for (SoundChannel& chn : sndChannels) 
+    assert(owner < trackChannels.size());
+    for (size_t i : trackChannels[owner]) 
     {
-        if (chn.GetOwner() == owner && (
-                    key == NOTE_ALL || (
-                        chn.GetMidiKey() == key &&
-                        chn.GetNoteLength() == NOTE_TIE))) {
+        SoundChannel& chn = sndChannels[i];
+        if (key == NOTE_ALL || (
+                    chn.GetMidiKey() == key &&
+                    chn.GetNoteLength() == NOTE_TIE)) {
             chn.Release();
             //return;
         }
@@ -205,15 +288,188 @@ void SoundMixer::StopChannel(uint8_t owner, uint8_t key)
 
 std::vector<std::vector<float>>& SoundMixer::ProcessAndGetAudio()
 {
-    clearBuffers();
+    if (profiling)
+        updatePeakChannels();
+    updateRenderMutes();
+    clearBuffers(1);
     renderToBuffers();
     purgeChannels();
     return soundBuffers;
 }
 
+void SoundMixer::BeginFrames(size_t maxFrames)
+{
+    // the muted tracks stay the same until the frames are rendered
+    updateRenderMutes();
+    recordedFrames = 0;
+    frameGains.clear();
+    frameGains.reserve(maxFrames);
+    for (size_t i = 0; i < cgbBuffers.size(); i++)
+    {
+        cgbBuffers[i].assign(N_CHANNELS * samplesPerBuffer * maxFrames, 0.0f);
+        cgbOwners[i].clear();
+    }
+}
+
+void SoundMixer::RecordFrame()
+{
+    CGBChannel *cgbs[] = {&sq1, &sq2, &wave, &noise};
+    if (profiling)
+        updatePeakChannels();
+    auto stageStart = chrono::high_resolution_clock::now();
+
+    size_t frame = recordedFrames++;
+    assert(cgbBuffers[0].size() >= recordedFrames * samplesPerBuffer * N_CHANNELS);
+    float masterFrom, masterTo;
+    stepFade(masterFrom, masterTo);
+    frameGains.emplace_back(masterFrom, masterTo);
+
+    // voices may die here, but they aren't purged before rendering, so no other note can reuse them
+    size_t pcmBlocks = engineRateMix ? busBlocks : samplesPerBuffer;
+    MixingArgs pcmArgs = getMixingArgs(engineRateMix ? fixedModeRate : sampleRate, pcmBlocks);
+    for (size_t i : activeChannels)
+    {
+        SoundChannel& chn = sndChannels[i];
+        if (skipAudio || renderMuted[chn.GetOwner()])
+            chn.Skip(pcmBlocks, pcmArgs);
+        else
+            chn.Record(frame, pcmBlocks, pcmArgs);
+    }
+    if (profiling) {
+        auto now = chrono::high_resolution_clock::now();
+        profile.pcm += chrono::duration<double>(now - stageStart).count();
+        stageStart = now;
+    }
+
+    MixingArgs margs = getMixingArgs(sampleRate, samplesPerBuffer);
+    for (size_t i = 0; i < cgbBuffers.size(); i++)
+    {
+        CGBChannel *cgb = cgbs[i];
+        cgbOwners[i].push_back(cgb->GetOwner());
+        if (cgb->GetOwner() == INVALID_OWNER)
+            continue;
+        assert(cgb->GetOwner() <= soundBuffers.size());
+        if (skipAudio || renderMuted[cgb->GetOwner()])
+            cgb->Skip(samplesPerBuffer, margs);
+        else
+            cgb->Process(cgbBuffers[i].data() + frame * samplesPerBuffer * N_CHANNELS, samplesPerBuffer, margs);
+    }
+    if (profiling)
+        profile.cgb += chrono::duration<double>(chrono::high_resolution_clock::now() - stageStart).count();
+}
+
+void SoundMixer::RenderFrames(size_t frames)
+{
+    assert(frames <= recordedFrames);
+    auto stageStart = chrono::high_resolution_clock::now();
+    auto nextStage = [&](double& stageTime) {
+        if (!profiling)
+            return;
+        auto now = chrono::high_resolution_clock::now();
+        stageTime += chrono::duration<double>(now - stageStart).count();
+        stageStart = now;
+    };
+
+    clearBuffers(frames);
+    pcmOnMaster = false;
+    if (!skipAudio) {
+        vector<vector<float>>& pcmBuffers = engineRateMix ? busBuffers : soundBuffers;
+        size_t pcmBlocks = engineRateMix ? busBlocks : samplesPerBuffer;
+        // voices mix in the same order as with ProcessAndGetAudio
+        for (size_t i : activeChannels)
+        {
+            SoundChannel& chn = sndChannels[i];
+            assert(chn.GetOwner() < pcmBuffers.size());
+            chn.RenderRecorded(pcmBuffers[chn.GetOwner()].data(), pcmBlocks, frames, renderScratch);
+        }
+        nextStage(profile.pcm);
+
+        assert(revdsps.size() == pcmBuffers.size());
+        for (size_t i = 0; i < pcmBuffers.size(); i++)
+        {
+            if (!renderMuted[i])
+                revdsps[i]->ProcessData(pcmBuffers[i].data(), pcmBlocks * frames);
+        }
+        nextStage(profile.reverb);
+
+        if (engineRateMix) {
+            for (size_t frame = 0; frame < frames; frame++)
+                convertBuses(frame);
+            nextStage(profile.pcm);
+        }
+
+        // CGB channels are added in the same order as with ProcessAndGetAudio
+        vector<vector<float>>& cgbTargets = engineRateMix ? cgbTracks : soundBuffers;
+        for (size_t frame = 0; frame < frames; frame++)
+        {
+            size_t offset = frame * samplesPerBuffer * N_CHANNELS;
+            for (size_t i = 0; i < cgbBuffers.size(); i++)
+            {
+                uint8_t owner = cgbOwners[i][frame];
+                if (owner == INVALID_OWNER)
+                    continue;
+                MixKernels::Accumulate(cgbTargets[owner].data() + offset,
+                        cgbBuffers[i].data() + offset, samplesPerBuffer * N_CHANNELS);
+            }
+        }
+        if (engineRateMix)
+            delayCGB(frames);
+        nextStage(profile.cgb);
+
+        float nBlocksReciprocal = 1.0f / float(samplesPerBuffer);
+        for (size_t frame = 0; frame < frames; frame++)
+        {
+            const pair<float, float>& g = frameGains[frame];
+            mixOutput(frame * samplesPerBuffer, g.first, (g.second - g.first) * nBlocksReciprocal);
+        }
+        nextStage(profile.mixing);
+    }
+
+    recordedFrames = 0;
+    frameGains.clear();
+    purgeChannels();
+}
+
+vector<vector<float>>& SoundMixer::GetTrackAudio()
+{
+    return soundBuffers;
+}
+
+vector<float>& SoundMixer::GetMasterAudio()
+{
+    return masterBuffer;
+}
+
+void SoundMixer::SetTrackMuted(uint8_t track, bool muted)
+{
+    assert(track < mutedTracks.size());
+    mutedTracks[track] = muted;
+}
+
+void SoundMixer::SetStemOutput(bool stemOutput)
+{
+    this->stemOutput = stemOutput;
+}
+
+void SoundMixer::SetMetering(bool metering)
+{
+    this->metering = metering;
+}
+
+void SoundMixer::GetTrackLoudness(uint8_t track, float& left, float& right)
+{
+    assert(track < trackLoudness.size());
+    trackLoudness[track].GetLoudness(left, right);
+}
+
+void SoundMixer::GetMasterLoudness(float& left, float& right)
+{
+    masterLoudness.GetLoudness(left, right);
+}
+
 size_t SoundMixer::GetActiveChannelCount()
 {
-    return sndChannels.size();
+    return activeChannels.size();
 }
 
 size_t SoundMixer::GetBufferUnitCount()
@@ -245,28 +501,253 @@ bool SoundMixer::IsFadeDone()
     return fadeMicroframesLeft == 0;
 }
 
+void SoundMixer::SetProfiling(bool profiling)
+{
+    this->profiling = profiling;
+}
+
+RenderProfile& SoundMixer::GetProfile()
+{
+    return profile;
+}
+
+void SoundMixer::SetSkipAudio(bool skipAudio)
+{
+    this->skipAudio = skipAudio;
+}
+
 /*
  * private SoundMixer
  */
 
 void SoundMixer::purgeChannels()
 {
-    sndChannels.remove_if([](SoundChannel& chn) { return chn.GetState() == EnvState::DEAD; });
+    // dead voices go back to the pool, the remaining ones keep their order
+    size_t kept = 0;
+    for (size_t i : activeChannels) {
+        if (sndChannels[i].GetState() == EnvState::DEAD)
+            freeChannels.push_back(i);
+        else
+            activeChannels[kept++] = i;
+    }
+    activeChannels.resize(kept);
+    for (vector<size_t>& tc : trackChannels) {
+        tc.erase(remove_if(tc.begin(), tc.end(), [this](size_t i) {
+            return sndChannels[i].GetState() == EnvState::DEAD;
+        }), tc.end());
+    }
+}
+
+void SoundMixer::updatePeakChannels()
+{
+    // dead voices (stolen ones or all of them while recording frames) stay in the list until the next purge
+    size_t active = 0;
+    for (size_t i : activeChannels) {
+        if (sndChannels[i].GetState() != EnvState::DEAD)
+            active++;
+    }
+    for (CGBChannel *cgb : initializer_list<CGBChannel *>{&sq1, &sq2, &wave, &noise}) {
+        if (cgb->GetOwner() != INVALID_OWNER)
+            active++;
+    }
+    profile.peakChannels = max(profile.peakChannels, active);
+}
+
+bool SoundMixer::freeVoiceFor(uint8_t owner, uint8_t prio)
+{
+    /*
+     * Voice stealing like the engine does it: released voices go first, otherwise only voices with
+     * a lower priority or the same priority on the same or a later track can be taken. Of these the one with
+     * the lowest priority, then the latest track and then the oldest voice loses its voice.
+     */
+    size_t live = 0;
+    size_t victim = 0;
+    bool found = false;
+    bool victimReleased = false;
+    for (size_t i : activeChannels)
+    {
+        SoundChannel& chn = sndChannels[i];
+        EnvState state = chn.GetState();
+        if (state == EnvState::DEAD)
+            continue;
+        live++;
+        bool released = state >= EnvState::REL;
+        if (!released && (chn.GetPriority() > prio || (chn.GetPriority() == prio && chn.GetOwner() < owner)))
+            continue;
+        if (victimReleased && !released)
+            continue;
+        // active voices are in the order they were started, so on a tie the older voice stays the victim
+        if (found && released == victimReleased) {
+            SoundChannel& v = sndChannels[victim];
+            if (chn.GetPriority() > v.GetPriority())
+                continue;
+            if (chn.GetPriority() == v.GetPriority() && chn.GetOwner() <= v.GetOwner())
+                continue;
+        }
+        victim = i;
+        victimReleased = released;
+        found = true;
+    }
+    if (live < pcmVoiceLimit)
+        return true;
+    if (!found)
+        return false;
+    // the voice stays in the lists until the next purge, but it won't play anymore
+    sndChannels[victim].Kill();
+    return true;
 }
 
-void SoundMixer::clearBuffers()
+void SoundMixer::updateRenderMutes()
 {
+    // muted tracks are only needed for stems, otherwise their voices just advance and the reverb waits
+    for (size_t i = 0; i < renderMuted.size(); i++)
+    {
+        bool muted = mutedTracks[i] && !stemOutput;
+        if (renderMuted[i] && !muted) {
+            // the echo and filter history are from before the track was muted
+            revdsps[i]->Reset();
+            if (engineRateMix) {
+                trackConverters[i] = RateConverter(busBlocks, samplesPerBuffer);
+                fill(cgbDelays[i].begin(), cgbDelays[i].end(), 0.0f);
+            }
+        }
+        renderMuted[i] = muted;
+    }
+}
+
+void SoundMixer::clearBuffers(size_t frames)
+{
+    // the buffers always have the size of the audio they hold
+    size_t nSamples = N_CHANNELS * samplesPerBuffer * frames;
     for (vector<float>& b : soundBuffers)
     {
-        fill(b.begin(), b.end(), 0.0f);
+        b.assign(nSamples, 0.0f);
+    }
+    masterBuffer.resize(nSamples);
+    if (engineRateMix) {
+        for (vector<float>& b : busBuffers)
+            b.assign(N_CHANNELS * busBlocks * frames, 0.0f);
+        for (vector<float>& b : cgbTracks)
+            b.assign(nSamples, 0.0f);
+        pcmMaster.resize(nSamples);
     }
 }
 
 void SoundMixer::renderToBuffers()
+{
+    float masterFrom, masterTo;
+    stepFade(masterFrom, masterTo);
+
+    MixingArgs margs = getMixingArgs(sampleRate, samplesPerBuffer);
+
+    auto stageStart = chrono::high_resolution_clock::now();
+    auto nextStage = [&](double& stageTime) {
+        if (!profiling)
+            return;
+        auto now = chrono::high_resolution_clock::now();
+        stageTime += chrono::duration<double>(now - stageStart).count();
+        stageStart = now;
+    };
+
+    pcmOnMaster = false;
+    if (engineRateMix) {
+        // PCM voices and reverb run at the engine rate, only the result gets converted
+        MixingArgs busArgs = getMixingArgs(fixedModeRate, busBlocks);
+        for (size_t i : activeChannels)
+        {
+            SoundChannel& chn = sndChannels[i];
+            assert(chn.GetOwner() < busBuffers.size());
+            if (skipAudio || renderMuted[chn.GetOwner()])
+                chn.Skip(busBlocks, busArgs);
+            else
+                chn.Process(busBuffers[chn.GetOwner()].data(), busBlocks, busArgs);
+        }
+        nextStage(profile.pcm);
+
+        assert(revdsps.size() == busBuffers.size());
+        for (size_t i = 0; i < busBuffers.size() && !skipAudio; i++)
+        {
+            if (!renderMuted[i])
+                revdsps[i]->ProcessData(busBuffers[i].data(), busBlocks);
+        }
+        nextStage(profile.reverb);
+
+        // the converters keep their filter history, so like the reverb they are left untouched while skipping
+        if (!skipAudio)
+            convertBuses(0);
+        nextStage(profile.pcm);
+    } else {
+        // process all digital channels
+        for (size_t i : activeChannels)
+        {
+            SoundChannel& chn = sndChannels[i];
+            assert(chn.GetOwner() < soundBuffers.size());
+            if (skipAudio || renderMuted[chn.GetOwner()])
+                chn.Skip(samplesPerBuffer, margs);
+            else
+                chn.Process(soundBuffers[chn.GetOwner()].data(), samplesPerBuffer, margs);
+        }
+        nextStage(profile.pcm);
+
+        // apply PCM reverb, its state depends on the audio so it is left untouched while skipping
+
+        assert(revdsps.size() == soundBuffers.size());
+        for (size_t i = 0; i < soundBuffers.size() && !skipAudio; i++)
+        {
+            if (!renderMuted[i])
+                revdsps[i]->ProcessData(soundBuffers[i].data(), samplesPerBuffer);
+        }
+        nextStage(profile.reverb);
+    }
+
+    // process all CGB channels
+
+    vector<vector<float>>& cgbTargets = engineRateMix ? cgbTracks : soundBuffers;
+    if (sq1.GetOwner() != INVALID_OWNER) {
+        assert(sq1.GetOwner() <= soundBuffers.size());
+        if (skipAudio || renderMuted[sq1.GetOwner()])
+            sq1.Skip(samplesPerBuffer, margs);
+        else
+            sq1.Process(cgbTargets[sq1.GetOwner()].data(), samplesPerBuffer, margs);
+    }
+    if (sq2.GetOwner() != INVALID_OWNER) {
+        assert(sq2.GetOwner() <= soundBuffers.size());
+        if (skipAudio || renderMuted[sq2.GetOwner()])
+            sq2.Skip(samplesPerBuffer, margs);
+        else
+            sq2.Process(cgbTargets[sq2.GetOwner()].data(), samplesPerBuffer, margs);
+    }
+    if (wave.GetOwner() != INVALID_OWNER) {
+        assert(wave.GetOwner() <= soundBuffers.size());
+        if (skipAudio || renderMuted[wave.GetOwner()])
+            wave.Skip(samplesPerBuffer, margs);
+        else
+            wave.Process(cgbTargets[wave.GetOwner()].data(), samplesPerBuffer, margs);
+    }
+    if (noise.GetOwner() != INVALID_OWNER) {
+        assert(noise.GetOwner() <= soundBuffers.size());
+        if (skipAudio || renderMuted[noise.GetOwner()])
+            noise.Skip(samplesPerBuffer, margs);
+        else
+            noise.Process(cgbTargets[noise.GetOwner()].data(), samplesPerBuffer, margs);
+    }
+    // like the converters, the delay lines are left untouched while skipping
+    if (engineRateMix && !skipAudio)
+        delayCGB(1);
+    nextStage(profile.cgb);
+
+    if (skipAudio)
+        return;
+
+    mixOutput(0, masterFrom, (masterTo - masterFrom) * margs.nBlocksReciprocal);
+    nextStage(profile.mixing);
+}
+
+void SoundMixer::stepFade(float& masterFrom, float& masterTo)
 {
     // master volume calculation
-    float masterFrom = masterVolume;
-    float masterTo = masterVolume;
+    masterFrom = masterVolume;
+    masterTo = masterVolume;
     if (fadeMicroframesLeft > 0) {
         if (fadePos < 0.f) {
             masterFrom = 0.f;
@@ -281,57 +762,106 @@ void SoundMixer::renderToBuffers()
         }
         fadeMicroframesLeft--;
     }
+}
 
+MixingArgs SoundMixer::getMixingArgs(uint32_t rate, size_t nBlocks)
+{
     MixingArgs margs;
     margs.vol = pcmMasterVolume;
     margs.fixedModeRate = fixedModeRate;
-    margs.sampleRateReciprocal = sampleRateReciprocal;
-    margs.nBlocksReciprocal = 1.0f / float(samplesPerBuffer);
+    margs.sampleRate = rate;
+    margs.sampleRateReciprocal = rate == sampleRate ? sampleRateReciprocal : 1.0f / float(rate);
+    margs.nBlocksReciprocal = 1.0f / float(nBlocks);
+    return margs;
+}
 
-    // process all digital channels
-    for (SoundChannel& chn : sndChannels)
-    {
-        assert(chn.GetOwner() < soundBuffers.size());
-        chn.Process(soundBuffers[chn.GetOwner()].data(), samplesPerBuffer, margs);
+void SoundMixer::convertBuses(size_t frame)
+{
+    size_t busOffset = frame * busBlocks * N_CHANNELS;
+    size_t offset = frame * samplesPerBuffer * N_CHANNELS;
+    if (stemOutput || metering) {
+        for (size_t i = 0; i < busBuffers.size(); i++)
+        {
+            if (!renderMuted[i])
+                trackConverters[i].Process(soundBuffers[i].data() + offset, busBuffers[i].data() + busOffset);
+        }
+    } else {
+        // only the mixdown is needed, so a single conversion of the summed buses is enough
+        fill(busMaster.begin(), busMaster.end(), 0.0f);
+        for (size_t i = 0; i < busBuffers.size(); i++)
+        {
+            if (!mutedTracks[i])
+                MixKernels::Accumulate(busMaster.data(), busBuffers[i].data() + busOffset, busBlocks * N_CHANNELS);
+        }
+        masterConverter.Process(pcmMaster.data() + offset, busMaster.data());
+        pcmOnMaster = true;
     }
+}
 
-    // apply PCM reverb
-
-    assert(revdsps.size() == soundBuffers.size());
-    for (size_t i = 0; i < soundBuffers.size(); i++)
+void SoundMixer::delayCGB(size_t frames)
+{
+    // the stream may end without a frame to render
+    if (frames == 0)
+        return;
+    size_t nSamples = N_CHANNELS * samplesPerBuffer * frames;
+    for (size_t i = 0; i < cgbTracks.size(); i++)
     {
-        revdsps[i]->ProcessData(soundBuffers[i].data(), samplesPerBuffer);
+        if (renderMuted[i])
+            continue;
+        // the delay line holds the end of the previous frames
+        vector<float>& delay = cgbDelays[i];
+        const float *src = cgbTracks[i].data();
+        float *dst = soundBuffers[i].data();
+        size_t nDelay = delay.size();
+        MixKernels::Accumulate(dst, delay.data(), nDelay);
+        MixKernels::Accumulate(dst + nDelay, src, nSamples - nDelay);
+        copy(src + nSamples - nDelay, src + nSamples, delay.begin());
     }
+}
 
-    // process all CGB channels
-
-    if (sq1.GetOwner() != INVALID_OWNER) {
-        assert(sq1.GetOwner() <= soundBuffers.size());
-        sq1.Process(soundBuffers[sq1.GetOwner()].data(), samplesPerBuffer, margs);
-    }
-    if (sq2.GetOwner() != INVALID_OWNER) {
-        assert(sq2.GetOwner() <= soundBuffers.size());
-        sq2.Process(soundBuffers[sq2.GetOwner()].data(), samplesPerBuffer, margs);
-    }
-    if (wave.GetOwner() != INVALID_OWNER) {
-        assert(wave.GetOwner() <= soundBuffers.size());
-        wave.Process(soundBuffers[wave.GetOwner()].data(), samplesPerBuffer, margs);
-    }
-    if (noise.GetOwner() != INVALID_OWNER) {
-        assert(noise.GetOwner() <= soundBuffers.size());
-        noise.Process(soundBuffers[noise.GetOwner()].data(), samplesPerBuffer, margs);
+void SoundMixer::mixOutput(size_t offset, float masterFrom, float masterStep)
+{
+    // master gain, mute mask, track sum and metering in a single pass over the chunks
+    bool unityGain = masterFrom == 1.0f && masterStep == 0.0f;
+    bool scaleTracks = (stemOutput || metering) && !unityGain;
+    if (metering) {
+        for (LoudnessCalculator& lc : trackLoudness)
+            lc.BeginBuffer(samplesPerBuffer);
+        masterLoudness.BeginBuffer(samplesPerBuffer);
     }
 
-    for (vector<float>& b : soundBuffers)
+    float gain = masterFrom;
+    for (size_t start = 0; start < samplesPerBuffer; start += MIX_CHUNK_BLOCKS)
     {
-        float masterStep = (masterTo - masterFrom) * margs.nBlocksReciprocal;
-        float masterLevel = masterFrom;
-        for (size_t i = 0; i < samplesPerBuffer; i++)
+        size_t nBlocks = min<size_t>(MIX_CHUNK_BLOCKS, samplesPerBuffer - start);
+        size_t pos = (offset + start) * N_CHANNELS;
+        float *master = masterBuffer.data() + pos;
+        if (pcmOnMaster)
+            copy(pcmMaster.begin() + long(pos), pcmMaster.begin() + long(pos + nBlocks * N_CHANNELS), master);
+        else
+            fill(master, master + nBlocks * N_CHANNELS, 0.0f);
+        float nextGain = gain;
+        for (size_t i = 0; i < soundBuffers.size(); i++)
         {
-            b[i * N_CHANNELS] *= masterLevel;
-            b[i * N_CHANNELS + 1] *= masterLevel;
-
-            masterLevel +=  masterStep;
+            float *track = soundBuffers[i].data() + pos;
+            if (scaleTracks)
+                nextGain = MixKernels::GainRamp(track, nBlocks, gain, masterStep);
+            if (metering)
+                trackLoudness[i].AddAudio(track, start, nBlocks);
+            if (!mutedTracks[i])
+                MixKernels::Accumulate(master, track, nBlocks * N_CHANNELS);
         }
+        // if nobody needs the scaled tracks it is enough to scale their sum
+        if (!scaleTracks && !unityGain)
+            nextGain = MixKernels::GainRamp(master, nBlocks, gain, masterStep);
+        if (metering)
+            masterLoudness.AddAudio(master, start, nBlocks);
+        gain = nextGain;
+    }
+
+    if (metering) {
+        for (LoudnessCalculator& lc : trackLoudness)
+            lc.EndBuffer();
+        masterLoudness.EndBuffer();
     }
 }
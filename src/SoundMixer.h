@@ -1,13 +1,15 @@
 #pragma once
 
 #include <vector>
-#include <list>
 #include <cstdint>
 #include <bitset>
+#include <utility>
 
 #include "ReverbEffect.h"
 #include "SoundChannel.h"
 #include "CGBChannel.h"
+#include "LoudnessCalculator.h"
+#include "RateConverter.h"
 #include "Constants.h"
 
 #define NOTE_ALL 0xFE
@@ -19,6 +21,13 @@
 // enable pan snap for CGB
 #define CGB_PAN_SNAP
 #define MASTER_VOL 1.0f
+// initial number of PCM voices, the pool doubles in size if it runs out of voices
+#define SOUND_CHANNEL_POOL_SIZE 32
+// the output stage works on parts of this many blocks so that all tracks stay in the L1 cache
+#define MIX_CHUNK_BLOCKS 128
+// lowpass frequencies of the loudness meters
+#define TRACK_METER_FREQ 5.0f
+#define MASTER_METER_FREQ 10.0f
 
 namespace agbplay
 {
@@ -26,29 +35,71 @@ namespace agbplay
     {
         public:
             SoundMixer(uint32_t sampleRate, uint32_t fixedModeRate, uint8_t reverb, float mvl, ReverbType rtype, uint8_t ntracks);
+            SoundMixer(const SoundMixer& other);
+            SoundMixer& operator=(const SoundMixer&) = delete;
             ~SoundMixer();
-            void NewSoundChannel(uint8_t owner, SampleInfo sInfo, ADSR env, Note note, uint8_t vol, int8_t pan, int16_t pitch, bool fixed);
+            // doesn't play the note if the voice limit is reached and no voice can be taken over
+            void NewSoundChannel(uint8_t owner, SampleInfo sInfo, ADSR env, Note note, uint8_t vol, int8_t pan, int16_t pitch, bool fixed, uint8_t prio);
             void NewCGBNote(uint8_t owner, CGBDef def, ADSR env, Note note, uint8_t vol, int8_t pan, int16_t pitch, CGBType type);
             void SetTrackPV(uint8_t owner, uint8_t vol, int8_t pan, int16_t pitch);
             int TickTrackNotes(uint8_t owner, std::bitset<NUM_NOTES>& activeNotes);
             void StopChannel(uint8_t owner, uint8_t key);
             std::vector<std::vector<float>>& ProcessAndGetAudio();
+            /*
+             * Renders several frames at once: after BeginFrames, RecordFrame advances all channels by a frame
+             * after each sequencer frame. RenderFrames then renders the first 'frames' recorded frames, so
+             * each voice resamples all of them at once. See StreamGenerator::ProcessFrames.
+             */
+            void BeginFrames(size_t maxFrames);
+            void RecordFrame();
+            void RenderFrames(size_t frames);
+            // track audio of the last ProcessAndGetAudio or RenderFrames
+            std::vector<std::vector<float>>& GetTrackAudio();
+            // sum of all tracks that aren't muted, valid after ProcessAndGetAudio
+            std::vector<float>& GetMasterAudio();
+            // without stem output muted tracks aren't rendered, their voices only advance and their meters read silence
+            void SetTrackMuted(uint8_t track, bool muted);
+            // without stem output the track buffers only hold intermediate results
+            void SetStemOutput(bool stemOutput);
+            // loudness meters for each track and the master, off by default
+            void SetMetering(bool metering);
+            void GetTrackLoudness(uint8_t track, float& left, float& right);
+            void GetMasterLoudness(float& left, float& right);
             size_t GetActiveChannelCount();
             size_t GetBufferUnitCount();
             uint32_t GetRenderSampleRate();
             void FadeOut(float millis);
             void FadeIn(float millis);
             bool IsFadeDone();
+            void SetProfiling(bool profiling);
+            RenderProfile& GetProfile();
+            // only advance the channel state without producing audio, the reverb is left untouched
+            void SetSkipAudio(bool skipAudio);
 
         private:
             void purgeChannels();
-            void clearBuffers();
+            bool freeVoiceFor(uint8_t owner, uint8_t prio);
+            void updateRenderMutes();
+            void updatePeakChannels();
+            void clearBuffers(size_t frames);
             void renderToBuffers();
+            void stepFade(float& masterFrom, float& masterTo);
+            MixingArgs getMixingArgs(uint32_t rate, size_t nBlocks);
+            void convertBuses(size_t frame);
+            void delayCGB(size_t frames);
+            void mixOutput(size_t offset, float masterFrom, float masterStep);
 
             std::bitset<NUM_NOTES> activeBackBuffer;
 
             // channel management
-            std::list<SoundChannel> sndChannels;
+            // PCM voice pool, active voices are listed in the order they were started
+            std::vector<SoundChannel> sndChannels;
+            std::vector<size_t> activeChannels;
+            std::vector<size_t> freeChannels;
+            // active voices of each track, so track commands don't have to look at every voice
+            std::vector<std::vector<size_t>> trackChannels;
+            // maximum number of voices that aren't dead, 0 means unlimited
+            size_t pcmVoiceLimit;
             SquareChannel sq1;
             SquareChannel sq2;
             WaveChannel wave;
@@ -56,6 +107,37 @@ namespace agbplay
 
             std::vector<ReverbEffect *> revdsps;
             std::vector<std::vector<float>> soundBuffers;
+            std::vector<float> masterBuffer;
+            std::vector<bool> mutedTracks;
+            // tracks that are skipped by the current frame(s), see updateRenderMutes
+            std::vector<bool> renderMuted;
+            std::vector<LoudnessCalculator> trackLoudness;
+            LoudnessCalculator masterLoudness;
+            bool stemOutput;
+            bool metering;
+            // engine rate mode: PCM voices and their reverb run on a bus per track at fixedModeRate,
+            // the buses are converted to the output rate per track or, if only the mixdown is needed, once
+            bool engineRateMix;
+            size_t busBlocks;
+            std::vector<std::vector<float>> busBuffers;
+            std::vector<float> busMaster;
+            std::vector<float> pcmMaster;
+            std::vector<RateConverter> trackConverters;
+            RateConverter masterConverter;
+            // the PCM audio of the current frame is in pcmMaster instead of the track buffers
+            bool pcmOnMaster;
+            // the converted PCM audio lags by the latency of the converters, so the CGB channels render
+            // to cgbTracks and reach the track buffers delayed by as much, see delayCGB
+            std::vector<std::vector<float>> cgbTracks;
+            std::vector<std::vector<float>> cgbDelays;
+            // multi-frame rendering: the master gain of each recorded frame, CGB channels are rendered
+            // while recording to buffers of their own and added to their owner after the PCM reverb
+            size_t recordedFrames;
+            std::vector<std::pair<float, float>> frameGains;
+            std::vector<std::vector<float>> cgbBuffers;
+            std::vector<std::vector<uint8_t>> cgbOwners;
+            // resampler output of a single voice, see SoundChannel::RenderRecorded
+            std::vector<float> renderScratch;
             uint32_t sampleRate;
             uint32_t fixedModeRate;
             size_t samplesPerBuffer;
@@ -70,5 +152,10 @@ namespace agbplay
             size_t fadeMicroframesLeft;
 
             uint8_t ntracks;
+
+            bool profiling;
+            RenderProfile profile;
+
+            bool skipAudio;
     };
 }
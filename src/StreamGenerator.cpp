@@ -1,4 +1,5 @@
 #include <cmath>
+#include <chrono>
 
 #include "StreamGenerator.h"
 #include "Xcept.h"
@@ -56,17 +57,25 @@ const map<uint8_t, int8_t> StreamGenerator::noteLut = {
     {0xF8,76}, {0xF9,78}, {0xFA,80}, {0xFB,84}, {0xFC,88}, {0xFD,90}, {0xFE,92}, {0xFF,96}
 };
 
-StreamGenerator::StreamGenerator(Sequence& seq, EnginePars ep, uint8_t maxLoops, float speedFactor, ReverbType rtype) 
+StreamGenerator::StreamGenerator(Sequence& seq, EnginePars ep, uint8_t maxLoops, float speedFactor, ReverbType rtype, uint32_t sampleRate) 
 : seq(seq), sbnk(seq.GetRom(), seq.GetSndBnk()), 
-    sm(STREAM_SAMPLERATE, freqLut[clip<uint8_t>(0, uint8_t(ep.freq-1), 11)], 
+    sm(sampleRate, freqLut[clip<uint8_t>(0, uint8_t(ep.freq-1), 11)], 
             (ep.rev >= 0x80) ? ep.rev & 0x7F : seq.GetReverb() & 0x7F,
             float(ep.vol + 1) / 16.0f,
             rtype, (uint8_t)seq.tracks.size())
 {
     this->ep = ep;
     this->maxLoops = maxLoops;
+    this->loopCount = 0;
     this->speedFactor = speedFactor;
     this->isEnding = false;
+    this->stopAtLoop = false;
+    this->loopReached = false;
+    this->frameCount = 0;
+    this->loopStartFrame = 0;
+    this->loopEndFrame = 0;
+    this->profiling = false;
+    this->sequencerTime = 0.0;
 }
 
 StreamGenerator::~StreamGenerator()
@@ -90,13 +99,64 @@ uint32_t StreamGenerator::GetRenderSampleRate()
 
 vector<vector<float>>& StreamGenerator::ProcessAndGetAudio()
 {
-    processSequenceFrame();
+    advanceFrame();
     return sm.ProcessAndGetAudio();
 }
 
+size_t StreamGenerator::ProcessFrames(size_t maxFrames)
+{
+    sm.BeginFrames(maxFrames);
+    size_t frames = 0;
+    while (frames < maxFrames) {
+        advanceFrame();
+        sm.RecordFrame();
+        // like with ProcessAndGetAudio the frame in which the stream ends isn't part of the output
+        if (HasStreamEnded())
+            break;
+        frames++;
+    }
+    sm.RenderFrames(frames);
+    return frames;
+}
+
+vector<vector<float>>& StreamGenerator::GetTrackAudio()
+{
+    return sm.GetTrackAudio();
+}
+
+vector<float>& StreamGenerator::GetMasterAudio()
+{
+    return sm.GetMasterAudio();
+}
+
+void StreamGenerator::SetStemOutput(bool stemOutput)
+{
+    sm.SetStemOutput(stemOutput);
+}
+
+void StreamGenerator::SetMetering(bool metering)
+{
+    sm.SetMetering(metering);
+}
+
+void StreamGenerator::GetTrackLoudness(uint8_t track, float& left, float& right)
+{
+    sm.GetTrackLoudness(track, left, right);
+}
+
+void StreamGenerator::GetMasterLoudness(float& left, float& right)
+{
+    sm.GetMasterLoudness(left, right);
+}
+
 bool StreamGenerator::HasStreamEnded()
 {
-    return isEnding && sm.IsFadeDone();
+    return loopReached || (isEnding && sm.IsFadeDone());
+}
+
+size_t StreamGenerator::GetLoopCount()
+{
+    return loopCount;
 }
 
 Sequence& StreamGenerator::GetWorkingSequence()
@@ -109,10 +169,56 @@ void StreamGenerator::SetSpeedFactor(float speedFactor)
     this->speedFactor = speedFactor;
 }
 
+void StreamGenerator::SetStopAtLoop(bool stopAtLoop)
+{
+    this->stopAtLoop = stopAtLoop;
+}
+
+bool StreamGenerator::GetLoopPoints(size_t& loopStart, size_t& loopEnd)
+{
+    if (!loopReached)
+        return false;
+    loopStart = loopStartFrame * sm.GetBufferUnitCount();
+    loopEnd = loopEndFrame * sm.GetBufferUnitCount();
+    return true;
+}
+
+void StreamGenerator::SetProfiling(bool profiling)
+{
+    this->profiling = profiling;
+    sm.SetProfiling(profiling);
+}
+
+RenderProfile StreamGenerator::GetProfile()
+{
+    RenderProfile profile = sm.GetProfile();
+    profile.sequencer = sequencerTime;
+    return profile;
+}
+
+void StreamGenerator::SetSkipAudio(bool skipAudio)
+{
+    sm.SetSkipAudio(skipAudio);
+}
+
 /*
  * private StreamGenerator
  */
 
+void StreamGenerator::advanceFrame()
+{
+    if (profiling) {
+        auto startTime = chrono::high_resolution_clock::now();
+        processSequenceFrame();
+        sequencerTime += chrono::duration<double>(chrono::high_resolution_clock::now() - startTime).count();
+    } else {
+        processSequenceFrame();
+    }
+    frameCount++;
+    for (size_t i = 0; i < seq.tracks.size(); i++)
+        sm.SetTrackMuted(uint8_t(i), seq.tracks[i].muted);
+}
+
 void StreamGenerator::processSequenceFrame()
 {
     seq.bpmStack += uint32_t(float(seq.bpm) * speedFactor);
@@ -149,6 +255,8 @@ void StreamGenerator::processSequenceTick()
         // count down last delay and process
         bool updatePV = false;
         if (--cTrk.delay <= 0) {
+            if (ntrk == 0 && stopAtLoop && !isEnding)
+                loopCandidates.emplace_back(cTrk.pos, frameCount);
             while (cTrk.isRunning) {
                 uint8_t cmd = reader[cTrk.pos++];
                 // check if a previous command should be repeated
@@ -251,7 +359,27 @@ void StreamGenerator::processSequenceTick()
                             break;
                         case 0xB2:
                             // GOTO
+                            if (ntrk == 0 && stopAtLoop && !isEnding) {
+                                // the loop is seamless if the target is where a tick started earlier
+                                long target = reader.AGBPtrToPos(*(uint32_t *)&reader[cTrk.pos]);
+                                for (const auto& cand : loopCandidates) {
+                                    if (cand.first == target && cand.second < frameCount) {
+                                        loopStartFrame = cand.second;
+                                        loopEndFrame = frameCount;
+                                        loopReached = isEnding = true;
+                                        break;
+                                    }
+                                }
+                                loopCandidates.clear();
+                                if (loopReached) {
+                                    cTrk.pos = target;
+                                    break;
+                                }
+                                // no usable loop start, fall back to regular looping
+                                stopAtLoop = false;
+                            }
                             if (ntrk == 0) {
+                                loopCount++;
                                 if (maxLoops-- <= 0) {
                                     isEnding = true;
                                     sm.FadeOut(SONG_FADE_OUT_TIME);
@@ -295,7 +423,7 @@ void StreamGenerator::processSequenceTick()
                             cTrk.pos += 3;
                             break;
                         case 0xBA:
-                            // PRIO, TODO actually do something with the prio
+                            // PRIO, used for voice stealing
                             cTrk.prio = reader[cTrk.pos++];
                             break;
                         case 0xBB:
@@ -472,6 +600,8 @@ void StreamGenerator::playNote(Sequence::Track& trk, Note note, uint8_t owner)
 
     uint8_t oldKey = note.midiKey;
     note.midiKey = sbnk.GetMidiKey(trk.prog, oldKey);
+    // like the engine the song and track priority add up
+    uint8_t prio = uint8_t(min(int(seq.GetPriority()) + int(trk.prio), 0xFF));
     switch (sbnk.GetInstrType(trk.prog, oldKey)) {
         case InstrType::PCM:
             {
@@ -484,7 +614,8 @@ void StreamGenerator::playNote(Sequence::Track& trk, Note note, uint8_t owner)
                         trk.GetVol(),
                         (pan & 0x80) ? int8_t(int(pan) - 0xC0) : trk.GetPan(),
                         trk.GetPitch(),
-                        false);
+                        false,
+                        prio);
             }
             break;
         case InstrType::PCM_FIXED:
@@ -498,7 +629,8 @@ void StreamGenerator::playNote(Sequence::Track& trk, Note note, uint8_t owner)
                         trk.GetVol(),
                         (pan & 0x80) ? int8_t(int(pan) - 0xC0) : trk.GetPan(),
                         trk.GetPitch(),
-                        true);
+                        true,
+                        prio);
             }
             break;
         case InstrType::SQ1:
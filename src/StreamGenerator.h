@@ -2,11 +2,15 @@
 
 #include <map>
 #include <vector>
+#include <utility>
 
 #include "Constants.h"
 #include "SoundData.h"
 #include "SoundMixer.h"
 
+// frames that offline renders pass to a single ProcessFrames call
+#define RENDER_QUANTUM_FRAMES 4
+
 namespace agbplay
 {
     struct EnginePars
@@ -22,16 +26,43 @@ namespace agbplay
     class StreamGenerator
     {
         public:
-            StreamGenerator(Sequence& seq, EnginePars ep, uint8_t maxLoops, float speedFactor, ReverbType rtype);
+            // all buffer sizes and rate dependent tables are derived from sampleRate here
+            StreamGenerator(Sequence& seq, EnginePars ep, uint8_t maxLoops, float speedFactor, ReverbType rtype, uint32_t sampleRate);
+            // copies are complete snapshots of the sequencer and mixer state
+            StreamGenerator(const StreamGenerator& other) = default;
             ~StreamGenerator();
 
             size_t GetBufferUnitCount();
             size_t GetActiveChannelCount();
             uint32_t GetRenderSampleRate();
             std::vector<std::vector<float>>& ProcessAndGetAudio();
+            /*
+             * Advances the song by up to maxFrames frames and renders them at once, which saves the per call
+             * overhead of each voice. Returns the number of frames before the end of the stream, their audio
+             * is in GetTrackAudio and GetMasterAudio afterwards.
+             */
+            size_t ProcessFrames(size_t maxFrames);
+            std::vector<std::vector<float>>& GetTrackAudio();
+            // mixdown of the tracks that aren't muted, see SoundMixer::GetMasterAudio
+            std::vector<float>& GetMasterAudio();
+            void SetStemOutput(bool stemOutput);
+            void SetMetering(bool metering);
+            void GetTrackLoudness(uint8_t track, float& left, float& right);
+            void GetMasterLoudness(float& left, float& right);
             bool HasStreamEnded();
+            // number of times track 0 jumped back to its loop start
+            size_t GetLoopCount();
             Sequence& GetWorkingSequence();
             void SetSpeedFactor(float speedFactor);
+            // ends the stream (without fade) when track 0 jumps back to its loop start
+            void SetStopAtLoop(bool stopAtLoop);
+            // loop start and end in sample frames, only valid after the stream stopped at the loop
+            bool GetLoopPoints(size_t& loopStart, size_t& loopEnd);
+            // collects the time spent in the sequencer and each mixing stage
+            void SetProfiling(bool profiling);
+            RenderProfile GetProfile();
+            // advance the song without rendering PCM audio, see SoundMixer::SetSkipAudio
+            void SetSkipAudio(bool skipAudio);
 
             static const std::map<uint8_t, int8_t> delayLut;
             static const std::map<uint8_t, int8_t> noteLut;
@@ -46,8 +77,21 @@ namespace agbplay
 
             bool isEnding;
             uint8_t maxLoops;
+            size_t loopCount;
             float speedFactor;
 
+            bool stopAtLoop;
+            bool loopReached;
+            size_t frameCount;
+            size_t loopStartFrame;
+            size_t loopEndFrame;
+            // track 0 positions at which a tick started processing events and the frame it happened in
+            std::vector<std::pair<long, size_t>> loopCandidates;
+
+            bool profiling;
+            double sequencerTime;
+
+            void advanceFrame();
             void processSequenceFrame();
             void processSequenceTick();
             void playNote(Sequence::Track& trk, Note note, uint8_t owner);
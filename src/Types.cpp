@@ -58,7 +58,7 @@ std::string agbplay::res2str(ResamplerType t)
     return "LINEAR";
 }
 
-bool agbplay::str2mono(const std::string& str)
+bool agbplay::str2bool(const std::string& str)
 {
     if (str == "TRUE")
         return true;
@@ -66,9 +66,9 @@ bool agbplay::str2mono(const std::string& str)
         return false;
 }
 
-std::string agbplay::mono2str(bool mono)
+std::string agbplay::bool2str(bool b)
 {
-    if (mono == true)
+    if (b == true)
         return "TRUE";
     else
         return "FALSE";
@@ -142,3 +142,17 @@ SampleInfo::SampleInfo(int8_t *samplePtr, float midCfreq, bool loopEnabled, uint
 SampleInfo::SampleInfo()
 {
 }
+
+/*
+ * public RenderProfile
+ */
+
+RenderProfile::RenderProfile()
+{
+    this->sequencer = 0.0;
+    this->pcm = 0.0;
+    this->cgb = 0.0;
+    this->reverb = 0.0;
+    this->mixing = 0.0;
+    this->peakChannels = 0;
+}
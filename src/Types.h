@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <cstddef>
 #include <string>
 
 // for increased quality we process in subframes (including the base frame)
@@ -19,8 +20,9 @@ namespace agbplay
     std::string rev2str(ReverbType t);
     ResamplerType str2res(const std::string& str);
     std::string res2str(ResamplerType t);
-    bool str2mono(const std::string& str);
-    std::string mono2str(bool mono);
+    // TRUE or FALSE of the boolean config keys
+    bool str2bool(const std::string& str);
+    std::string bool2str(bool b);
 
     union CGBDef
     {
@@ -33,6 +35,7 @@ namespace agbplay
     {
         float vol;
         uint32_t fixedModeRate;
+        uint32_t sampleRate;
         float sampleRateReciprocal;
         float nBlocksReciprocal;
     };
@@ -67,6 +70,18 @@ namespace agbplay
         int8_t length;
     };
 
+    // seconds spent in each rendering stage, only collected while profiling
+    struct RenderProfile
+    {
+        RenderProfile();
+        double sequencer;
+        double pcm;
+        double cgb;
+        double reverb;
+        double mixing;
+        size_t peakChannels;
+    };
+
     struct SampleInfo
     {
         SampleInfo(int8_t *samplePtr, float midCfreq, bool loopEnabled, uint32_t loopPos, uint32_t endPos);
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <stdexcept>
+#include <cstdint>
+#include <cstddef>
 #include <boost/format.hpp>
 
 #ifndef M_PI
@@ -9,6 +11,10 @@
 
 #define PI_F (float(M_PI))
 
+// 64 bit FNV-1a, used for content hashes of ROM data
+#define FNV_HASH_INIT 0xCBF29CE484222325ull
+#define FNV_HASH_PRIME 0x100000001B3ull
+
 template <typename T>
 inline static T clip(T min, T val, T max)
 {
@@ -24,3 +30,15 @@ inline void CStrAppend(char *dest, size_t *index, const char *src)
     while ((ch = *copyChar++) != '\0')
         dest[(*index)++] = ch;
 }
+
+inline void HashByte(uint64_t& hash, uint8_t b)
+{
+    hash = (hash ^ b) * FNV_HASH_PRIME;
+}
+
+inline void HashBytes(uint64_t& hash, const void *data, size_t len)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < len; i++)
+        HashByte(hash, bytes[i]);
+}
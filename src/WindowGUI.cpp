@@ -191,21 +191,28 @@ bool WindowGUI::Handle()
             case 'e':
                 mplay->Stop();
                 {
-                    SoundExporter se(*conUI, sdata, rom, false, true);
+                    SoundExporter se(sdata, rom, false, ExportMode::TRACKS);
+                    se.Export("wav", ConfigManager::Instance().GetCfg().GetGameEntries(), playUI->GetTicked());
+                }
+                break;
+            case 'E':
+                mplay->Stop();
+                {
+                    SoundExporter se(sdata, rom, false, ExportMode::TRACKS_AND_MIXDOWN);
                     se.Export("wav", ConfigManager::Instance().GetCfg().GetGameEntries(), playUI->GetTicked());
                 }
                 break;
             case 'r':
                 mplay->Stop();
                 {
-                    SoundExporter se(*conUI, sdata, rom, false, false);
+                    SoundExporter se(sdata, rom, false, ExportMode::MIXDOWN);
                     se.Export("wav", ConfigManager::Instance().GetCfg().GetGameEntries(), playUI->GetTicked());
                 }
                 break;
             case 'b':
                 mplay->Stop();
                 {
-                    SoundExporter se(*conUI, sdata, rom, true, false);
+                    SoundExporter se(sdata, rom, true, ExportMode::MIXDOWN);
                     se.Export("wav", ConfigManager::Instance().GetCfg().GetGameEntries(), playUI->GetTicked());
                 }
                 break;
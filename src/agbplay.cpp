@@ -4,6 +4,16 @@
 #include <curses.h>
 #include <portaudio.h>
 #include <clocale>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <memory>
+#include <cctype>
 #ifdef __APPLE__
     #include <libproc.h>
     #include <unistd.h>
@@ -16,10 +26,20 @@
 #include "WindowGUI.h"
 #include "Xcept.h"
 #include "ConfigManager.h"
+#include "SoundExporter.h"
+#include "MixKernels.h"
+#include "Resampler.h"
+#include "CGBPatterns.h"
+#include "SoundMixer.h"
+#include "StreamGenerator.h"
+#include "BenchmarkSong.h"
 
 using namespace std;
 using namespace agbplay;
 
+// changing the seed changes the song, so timings taken with different seeds can't be compared
+#define BENCH_SONG_SEED 1234
+
 
 #ifdef __APPLE__
 
@@ -64,51 +84,481 @@ int CheckForAppleTerminal() {
 }
 #endif
 
-int main(int argc, char *argv[]) 
+static void printUsage()
 {
-    #ifdef __APPLE__
-    if (CheckForAppleTerminal() == 1) {
-        cout << "It appears that you are using macOS's built-in Terminal.app." << endl << endl <<
-                    "This terminal is prone to some serious lag with agbplay." << endl <<
-                    "It is recommended to use iTerm2 (https://www.iterm2.com/), as it can" << endl <<
-                    "run agbplay without any lag." << endl << endl << 
-                    "Press Return to continue, or Ctrl+C to exit.";
-        cin.ignore();
+    cout << "Usage: ./agbplay <ROM.gba>" << endl <<
+        "       ./agbplay --export <ROM.gba> [options]" << endl <<
+        "       ./agbplay --bench <ROM.gba> [options]" << endl <<
+        "       ./agbplay --bench-resampler [--rate <hz>] [--simd <set>]" << endl <<
+        "       ./agbplay --bench-song [--rate <hz>] [--simd <set>]" << endl <<
+        "       ./agbplay --self-test" << endl;
+}
+
+static void printHelp()
+{
+    printUsage();
+    cout << endl <<
+        "Controls:" << endl <<
+        "  - Arrow Keys or HJKL: Navigate through the program" << endl <<
+        "  - Tab: Change between Playlist and Songlist" << endl <<
+        "  - A: Add the selected song to the playlist" << endl <<
+        "  - D: Delete the selected song from the playlist" << endl <<
+        "  - T: Toggle whether the song should be output to a file (see R and E)" << endl <<
+        "  - G: Drag the song through the playlist for ordering" << endl <<
+        "  - I: Force Song Restart" << endl <<
+        "  - O: Song Play/Pause" << endl <<
+        "  - P: Force Song Stop" << endl <<
+        "  - +=: Double the playback speed" << endl <<
+        "  - -: Halve the playback speed" << endl <<
+        "  - Enter: Toggle Track Muting" << endl <<
+        "  - M: Mute selected Track" << endl <<
+        "  - S: Solo selected Track" << endl <<
+        "  - U: Unmute all Tracks" << endl <<
+        "  - N: Rename the selected song in the playlisy" << endl <<
+        "  - E: Export selected songs to individual track files (to \"workdirectory/wav\")" << endl <<
+        "  - Shift-E: Export selected songs to individual track files and mixdown in one pass" << endl <<
+        "  - R: Export selected songs to files (non-split)" << endl <<
+        "  - B: Benchmark, Run the export program but don't write to file" << endl <<
+        "  - Q or Ctrl-D: Exit Program" << endl << endl <<
+        "Command line rendering (--export, --bench):" << endl <<
+        "  -s, --songs <list>   Songs to render, e.g. \"1,5,10-20\" (default: playlist)" << endl <<
+        "  -a, --all            Render every song of the song table once, skipping empty songs" << endl <<
+        "  -o, --output <dir>   Output directory (default: \"wav\")" << endl <<
+        "  -f, --format <fmt>   Output file format: " << SoundExporter::FormatNames() << " (default: wav)" << endl <<
+        "  -t, --tracks         Export individual track files instead of a mixdown" << endl <<
+        "  -m, --mixdown        Export the mixdown as well when used with --tracks" << endl <<
+        "  -c, --multichannel   Write all tracks to a single multichannel file" << endl <<
+        "  -l, --loop           Render the intro and one loop with loop points instead of two loops" << endl <<
+        "  -j, --jobs <n>       Number of render threads (default: all cores)" << endl <<
+        "  --segments           Threads not needed for separate songs render songs in segments," << endl <<
+        "                       the reverb at the segment starts is approximated" << endl <<
+        "  -r, --report <file>  JSON report for --bench (default: <output>/benchmark.json)" << endl <<
+        "  --cache <dir>        Render cache directory (default: RENDER_CACHE from the config)" << endl <<
+        "  --verify-segments    With --bench: compare segmented renders to serial renders" << endl <<
+        "  --rate <hz>          Output sample rate (default: SAMPLE_RATE from the config or " << STREAM_SAMPLERATE << ")" << endl <<
+        "  --simd <set>         Mixing kernels: scalar, sse2, avx2 or neon (default: best supported)" << endl << endl <<
+        "--bench-resampler times each resampler for one voice playing a square wave over the" << endl <<
+        "pitch range of the CGB square channels, --rate and --simd work like above." << endl <<
+        "--bench-song renders a minute of a synthetic dense 16 track song and prints the time" << endl <<
+        "spent in each stage, it doesn't need a ROM either." << endl <<
+        "--self-test compares the mixing kernels of every supported instruction set to the" << endl <<
+        "scalar ones and fails if any of them deviates." << endl;
+}
+
+static void printToStdout(const string& msg, void *)
+{
+    cout << msg << endl;
+}
+
+/*
+ * parses a song list like "1,5,10-20" to song IDs
+ * returns false on syntax errors or songs that are out of range
+ */
+static bool parseSongList(const string& list, unsigned short numSongs, vector<uint16_t>& uids)
+{
+    istringstream is(list);
+    string range;
+    while (getline(is, range, ',')) {
+        unsigned long first, last;
+        size_t dash = range.find('-');
+        try {
+            size_t idx;
+            first = stoul(range.substr(0, dash), &idx);
+            if (idx != dash && idx != range.size())
+                return false;
+            if (dash == string::npos) {
+                last = first;
+            } else {
+                last = stoul(range.substr(dash + 1), &idx);
+                if (idx != range.size() - dash - 1)
+                    return false;
+            }
+        } catch (const logic_error&) {
+            return false;
+        }
+        if (first > last || last >= numSongs)
+            return false;
+        for (unsigned long uid = first; uid <= last; uid++)
+            uids.push_back(uint16_t(uid));
     }
-    #endif
+    return !uids.empty();
+}
+
+/*
+ * parses a whole argument as unsigned decimal number
+ * returns false on signs, trailing characters and numbers that are too large
+ */
+static bool parseNumber(const string& str, unsigned long& n)
+{
+    // stoul accepts a sign, so "-1" has to be caught before
+    if (str.empty() || !isdigit(static_cast<unsigned char>(str[0])))
+        return false;
+    try {
+        size_t idx;
+        n = stoul(str, &idx);
+        return idx == str.size();
+    } catch (const logic_error&) {
+        return false;
+    }
+}
+
+/*
+ * renders songs without initializing the terminal UI or the audio device
+ */
+static int runHeadless(int argc, char *argv[], bool benchmarkOnly)
+{
+    string romPath;
+    string songList;
+    string outputDir = "wav";
+    ExportFormat format = ExportFormat::WAV_FLOAT;
+    bool tracks = false;
+    bool mixdown = false;
+    bool multichannel = false;
+    bool loop = false;
+    bool allSongs = false;
+    string reportFile;
+    string cacheDir;
+    bool cacheSet = false;
+    bool segments = false;
+    bool verifySegments = false;
+    size_t jobs = 0;
+    uint32_t sampleRate = 0;
+
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if ((arg == "-s" || arg == "--songs") && hasValue) {
+            songList = argv[++i];
+        } else if ((arg == "-o" || arg == "--output") && hasValue) {
+            outputDir = argv[++i];
+        } else if ((arg == "-f" || arg == "--format") && hasValue) {
+            if (!SoundExporter::ParseFormat(argv[++i], format)) {
+                cerr << "Unsupported output format: " << argv[i] << " (use " << SoundExporter::FormatNames() << ")" << endl;
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "-a" || arg == "--all") {
+            allSongs = true;
+        } else if (arg == "-t" || arg == "--tracks") {
+            tracks = true;
+        } else if (arg == "-m" || arg == "--mixdown") {
+            mixdown = true;
+        } else if (arg == "-c" || arg == "--multichannel") {
+            multichannel = true;
+        } else if (arg == "-l" || arg == "--loop") {
+            loop = true;
+        } else if (arg == "--cache" && hasValue) {
+            cacheDir = argv[++i];
+            cacheSet = true;
+        } else if (arg == "--rate" && hasValue) {
+            unsigned long rate;
+            if (!parseNumber(argv[++i], rate) || rate < MIN_SAMPLERATE || rate > MAX_SAMPLERATE) {
+                cerr << "Sample rate must be between " << MIN_SAMPLERATE << " and " << MAX_SAMPLERATE << " Hz" << endl;
+                return EXIT_FAILURE;
+            }
+            sampleRate = uint32_t(rate);
+        } else if (arg == "--simd" && hasValue) {
+            if (!MixKernels::SetInstructionSet(argv[++i])) {
+                cerr << "Instruction set not supported: " << argv[i] << endl;
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--segments") {
+            segments = true;
+        } else if (arg == "--verify-segments") {
+            verifySegments = true;
+        } else if ((arg == "-r" || arg == "--report") && hasValue) {
+            reportFile = argv[++i];
+        } else if ((arg == "-j" || arg == "--jobs") && hasValue) {
+            unsigned long n;
+            if (!parseNumber(argv[++i], n) || n < 1) {
+                cerr << "Invalid number of jobs: " << argv[i] << " (must be at least 1)" << endl;
+                return EXIT_FAILURE;
+            }
+            jobs = size_t(n);
+        } else if (romPath.empty() && arg[0] != '-') {
+            romPath = arg;
+        } else {
+            cerr << "Invalid argument: " << arg << endl;
+            printUsage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (romPath.empty()) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+    if (allSongs && !songList.empty()) {
+        cerr << "--all and --songs can't be used together" << endl;
+        return EXIT_FAILURE;
+    }
+    if (verifySegments && !benchmarkOnly) {
+        cerr << "--verify-segments can only be used with --bench" << endl;
+        return EXIT_FAILURE;
+    }
+
+    try {
+        _set_debug_callback(printToStdout, nullptr);
+        FileContainer fc(romPath);
+        Rom rom(fc);
+        ConfigManager::Instance().SetGameCode(rom.GetROMCode());
+        SoundData sdata(rom);
+
+        vector<SongEntry>& playlist = ConfigManager::Instance().GetCfg().GetGameEntries();
+        vector<SongEntry> entries;
+        if (songList.empty() && !allSongs) {
+            entries = playlist;
+        } else {
+            vector<uint16_t> uids;
+            if (allSongs) {
+                for (uint16_t uid = 0; uid < sdata.sTable->GetNumSongs(); uid++)
+                    uids.push_back(uid);
+            } else if (!parseSongList(songList, sdata.sTable->GetNumSongs(), uids)) {
+                cerr << "Invalid song list: " << songList << " (ROM has " << sdata.sTable->GetNumSongs() << " songs)" << endl;
+                return EXIT_FAILURE;
+            }
+            for (uint16_t uid : uids) {
+                // use the playlist name if there is one
+                auto named = find_if(playlist.begin(), playlist.end(),
+                        [uid](const SongEntry& e) { return e.GetUID() == uid; });
+                if (named != playlist.end()) {
+                    entries.push_back(*named);
+                } else {
+                    ostringstream txt;
+                    txt << setw(4) << setfill('0') << uid;
+                    entries.emplace_back(txt.str(), uid);
+                }
+            }
+        }
+        if (entries.empty()) {
+            cerr << "No songs to render, the playlist is empty (use --songs)" << endl;
+            return EXIT_FAILURE;
+        }
+
+        vector<bool> ticked(entries.size(), true);
+        ExportMode mode = ExportMode::MIXDOWN;
+        if (tracks)
+            mode = mixdown ? ExportMode::TRACKS_AND_MIXDOWN : ExportMode::TRACKS;
+        SoundExporter se(sdata, rom, benchmarkOnly, mode, jobs);
+        se.SetMultichannel(multichannel);
+        se.SetLoopExport(loop);
+        se.SetDeduplicate(allSongs);
+        se.SetReportFile(reportFile);
+        if (cacheSet)
+            se.SetRenderCache(cacheDir);
+        if (sampleRate != 0)
+            se.SetSampleRate(sampleRate);
+        se.SetSegmented(segments);
+        se.SetVerifySegments(verifySegments);
+        se.SetFormat(format);
+        if (!se.Export(outputDir, entries, ticked))
+            return EXIT_FAILURE;
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static bool squareFetchCallback(FetchBuffer& fetchBuffer, size_t samplesRequired, void *cbdata)
+{
+    size_t& pos = *static_cast<size_t *>(cbdata);
+    if (fetchBuffer.Size() >= samplesRequired)
+        return true;
+    size_t samplesToFetch = samplesRequired - fetchBuffer.Size();
+    float *dest = fetchBuffer.Append(samplesToFetch);
+    for (size_t i = 0; i < samplesToFetch; i++)
+        dest[i] = CGBPatterns::pat_sq50[pos++ % 8];
+    return true;
+}
+
+/*
+ * prints the time each resampler takes for a frame of a square wave, from C1 to C8
+ */
+static int runResamplerBenchmark(int argc, char *argv[])
+{
+    uint32_t sampleRate = STREAM_SAMPLERATE;
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--rate" && hasValue) {
+            unsigned long rate;
+            if (!parseNumber(argv[++i], rate) || rate < MIN_SAMPLERATE || rate > MAX_SAMPLERATE) {
+                cerr << "Sample rate must be between " << MIN_SAMPLERATE << " and " << MAX_SAMPLERATE << " Hz" << endl;
+                return EXIT_FAILURE;
+            }
+            sampleRate = uint32_t(rate);
+        } else if (arg == "--simd" && hasValue) {
+            if (!MixKernels::SetInstructionSet(argv[++i])) {
+                cerr << "Instruction set not supported: " << argv[i] << endl;
+                return EXIT_FAILURE;
+            }
+        } else {
+            cerr << "Invalid argument: " << arg << endl;
+            printUsage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    // 10 seconds of audio per measurement
+    const size_t frames = 600;
+    size_t nBlocks = size_t(round(sampleRate / (AGB_FPS * INTERFRAMES)));
+    vector<float> out(nBlocks);
+    cout << "Microseconds per voice and frame (" << nBlocks << " samples at " << sampleRate << " Hz, " <<
+        MixKernels::GetInstructionSet() << " kernels), a frame lasts " << fixed << setprecision(0) <<
+        1e6 / double(AGB_FPS * INTERFRAMES) << " us" << endl;
+    cout << "key  phaseInc   nearest    linear      sinc      blep" << endl;
+    for (int key = 24; key <= 108; key += 12) {
+        // same as SquareChannel::SetPitch, the pattern has 8 samples per period
+        float phaseInc = 3520.0f * powf(2.0f, float(key - 69) * (1.0f / 12.0f)) / float(sampleRate);
+        cout << setw(3) << key << setw(10) << setprecision(4) << phaseInc << setprecision(2);
+        unique_ptr<Resampler> resamplers[] = {
+            make_unique<NearestResampler>(), make_unique<LinearResampler>(),
+            make_unique<SincResampler>(), make_unique<BlepResampler>()
+        };
+        for (unique_ptr<Resampler>& rs : resamplers) {
+            size_t pos = 0;
+            auto start = chrono::high_resolution_clock::now();
+            for (size_t i = 0; i < frames; i++)
+                rs->Process(out.data(), nBlocks, phaseInc, squareFetchCallback, &pos);
+            double micros = chrono::duration<double, micro>(chrono::high_resolution_clock::now() - start).count();
+            cout << setw(10) << micros / double(frames);
+        }
+        cout << endl;
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+ * prints the time each stage takes to render the same synthetic song on any machine
+ */
+static int runSongBenchmark(int argc, char *argv[])
+{
+    uint32_t sampleRate = 0;
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--rate" && hasValue) {
+            unsigned long rate;
+            if (!parseNumber(argv[++i], rate) || rate < MIN_SAMPLERATE || rate > MAX_SAMPLERATE) {
+                cerr << "Sample rate must be between " << MIN_SAMPLERATE << " and " << MAX_SAMPLERATE << " Hz" << endl;
+                return EXIT_FAILURE;
+            }
+            sampleRate = uint32_t(rate);
+        } else if (arg == "--simd" && hasValue) {
+            if (!MixKernels::SetInstructionSet(argv[++i])) {
+                cerr << "Instruction set not supported: " << argv[i] << endl;
+                return EXIT_FAILURE;
+            }
+        } else {
+            cerr << "Invalid argument: " << arg << endl;
+            printUsage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    try {
+        BenchmarkSong song(BENCH_SONG_SEED);
+        Rom rom(song.GetContainer());
+        // engine settings come from the config section of the game code BNCH
+        ConfigManager::Instance().SetGameCode(rom.GetROMCode());
+        GameConfig& cfg = ConfigManager::Instance().GetCfg();
+        if (sampleRate == 0)
+            sampleRate = cfg.GetSampleRate();
+        if (sampleRate == 0)
+            sampleRate = STREAM_SAMPLERATE;
+        Sequence seq(song.GetSongPos(), cfg.GetTrackLimit(), rom);
+        // the song loops forever, so the generator never ends before the minute is rendered
+        StreamGenerator sg(seq, EnginePars(cfg.GetPCMVol(), cfg.GetEngineRev(), cfg.GetEngineFreq()), 255, 1.0f, cfg.GetRevType(), sampleRate);
+        sg.SetProfiling(true);
+        size_t frames = size_t(60.0 * AGB_FPS * INTERFRAMES);
+        size_t framesRendered = 0;
+        auto start = chrono::high_resolution_clock::now();
+        while (framesRendered < frames)
+            framesRendered += sg.ProcessFrames(min<size_t>(RENDER_QUANTUM_FRAMES, frames - framesRendered));
+        double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+        RenderProfile profile = sg.GetProfile();
+
+        double audioSeconds = double(framesRendered) / double(AGB_FPS * INTERFRAMES);
+        cout << "Rendered " << fixed << setprecision(1) << audioSeconds << " s of a " << seq.tracks.size() <<
+            " track song at " << sampleRate << " Hz (" << MixKernels::GetInstructionSet() << " kernels) in " <<
+            setprecision(3) << seconds << " s, " << setprecision(1) << audioSeconds / seconds << "x realtime" << endl;
+        cout << "Microseconds per frame:" << endl;
+        const pair<const char *, double> stages[] = {
+            { "sequencer", profile.sequencer }, { "pcm", profile.pcm }, { "cgb", profile.cgb },
+            { "reverb", profile.reverb }, { "mixing", profile.mixing }
+        };
+        for (const auto& stage : stages)
+            cout << "  " << left << setw(10) << stage.first << right << setw(10) << setprecision(2) <<
+                stage.second * 1e6 / double(framesRendered) << endl;
+        cout << "Peak active channels: " << profile.peakChannels << endl;
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+ * checks the mixing kernels of every instruction set the CPU supports, see make check
+ */
+static int runSelfTest(int argc)
+{
+    if (argc != 2) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+    bool passed = true;
+    for (const string& name : MixKernels::GetSupportedInstructionSets()) {
+        float error = MixKernels::SelfTest(name);
+        bool ok = error >= 0.0f && error <= MIX_KERNELS_TOLERANCE;
+        cout << left << setw(8) << name << right << " max. relative error " << error <<
+            (ok ? "  OK" : "  FAILED") << endl;
+        passed = passed && ok;
+    }
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[]) 
+{
     if (!_open_debug()) {
         cout << "Debug Init failed" << endl;
         return EXIT_FAILURE;
     }
+    // the command line modes return from any point, the debug log is closed here for all of them
+    if (argc >= 2 && (!strcmp("--export", argv[1]) || !strcmp("--bench", argv[1]) ||
+                !strcmp("--bench-resampler", argv[1]) || !strcmp("--bench-song", argv[1]) ||
+                !strcmp("--self-test", argv[1]))) {
+        int result;
+        if (!strcmp("--export", argv[1]))
+            result = runHeadless(argc, argv, false);
+        else if (!strcmp("--bench", argv[1]))
+            result = runHeadless(argc, argv, true);
+        else if (!strcmp("--bench-resampler", argv[1]))
+            result = runResamplerBenchmark(argc, argv);
+        else if (!strcmp("--bench-song", argv[1]))
+            result = runSongBenchmark(argc, argv);
+        else
+            result = runSelfTest(argc);
+        _close_debug();
+        return result;
+    }
     if (argc != 2) {
-        cout << "Usage: ./agbplay <ROM.gba>" << endl;
+        printUsage();
         return EXIT_FAILURE;
     }
     if (!strcmp("--help", argv[1])) {
-        cout << "Usage: ./agbplay <ROM.gba>" << endl << endl <<
-            "Controls:" << endl <<
-            "  - Arrow Keys or HJKL: Navigate through the program" << endl <<
-            "  - Tab: Change between Playlist and Songlist" << endl <<
-            "  - A: Add the selected song to the playlist" << endl <<
-            "  - D: Delete the selected song from the playlist" << endl <<
-            "  - T: Toggle whether the song should be output to a file (see R and E)" << endl <<
-            "  - G: Drag the song through the playlist for ordering" << endl <<
-            "  - I: Force Song Restart" << endl <<
-            "  - O: Song Play/Pause" << endl <<
-            "  - P: Force Song Stop" << endl <<
-            "  - +=: Double the playback speed" << endl <<
-            "  - -: Halve the playback speed" << endl <<
-            "  - Enter: Toggle Track Muting" << endl <<
-            "  - M: Mute selected Track" << endl <<
-            "  - S: Solo selected Track" << endl <<
-            "  - U: Unmute all Tracks" << endl <<
-            "  - N: Rename the selected song in the playlisy" << endl <<
-            "  - E: Export selected songs to individual track files (to \"workdirectory/wav\")" << endl <<
-            "  - R: Export selected songs to files (non-split)" << endl <<
-            "  - B: Benchmark, Run the export program but don't write to file" << endl <<
-            "  - Q or Ctrl-D: Exit Program" << endl;
+        printHelp();
         return EXIT_SUCCESS;
     }
+    #ifdef __APPLE__
+    if (CheckForAppleTerminal() == 1) {
+        cout << "It appears that you are using macOS's built-in Terminal.app." << endl << endl <<
+                    "This terminal is prone to some serious lag with agbplay." << endl <<
+                    "It is recommended to use iTerm2 (https://www.iterm2.com/), as it can" << endl <<
+                    "run agbplay without any lag." << endl << endl << 
+                    "Press Return to continue, or Ctrl+C to exit.";
+        cin.ignore();
+    }
+    #endif
     try {
         setlocale(LC_ALL, "");
         if (Pa_Initialize() != paNoError)